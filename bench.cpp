@@ -0,0 +1,299 @@
+// Headless end-to-end benchmark: generates synthetic inputs, loads them
+// into Document, drives View through scripted scrolling on the SDL dummy
+// video driver with the software renderer, and prints the measurements
+// as JSON to stdout (progress goes to stderr).
+//
+// usage: bench_app [output directory]
+// environment: BENCH_LARGE_MB (size of the multi-GB input, 0 to skip),
+//              BENCH_FONT (TTF font to render with)
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "sdl_wrapper.hpp"
+#include "document.hpp"
+#include "line_index.hpp"
+#include "view.hpp"
+#include "settings.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsed_ms(Clock::time_point since)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+}
+
+// ---- inputs ---------------------------------------------------------------
+
+/// Writes `size` bytes to the file, produced by `fill` a buffer at a time.
+static void write_file(std::string const& path, uint64_t size, std::function<void(std::string&)> const& fill)
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        throw std::runtime_error("could not create file: " + path);
+    }
+    std::string buffer;
+    for (uint64_t written = 0; written < size; ) {
+        buffer.clear();
+        fill(buffer);
+        auto count = std::min<uint64_t>(buffer.size(), size - written);
+        if (fwrite(buffer.data(), 1, count, file) != count) {
+            fclose(file);
+            throw std::runtime_error("could not write file: " + path);
+        }
+        written += count;
+    }
+    fclose(file);
+}
+
+// many short log-like lines
+static void fill_short_lines(std::string& buffer, std::mt19937& rng)
+{
+    static const char* LEVELS[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+    auto random = [&](unsigned n) { return unsigned(rng() % n); };
+    char line[160];
+    while (buffer.size() < (4u << 20)) {
+        int length = snprintf(line, sizeof(line), "2024-05-%02u %02u:%02u:%02u.%03u %-5s [worker-%u] request id=%u took %ums status=%u\n",
+            random(28) + 1, random(24), random(60), random(60), random(1000), LEVELS[random(4)],
+            random(64), unsigned(rng()), random(5000), 200 + random(4) * 100);
+        buffer.append(line, length);
+    }
+}
+
+// a few very long lines, like minified JSON
+static void fill_long_lines(std::string& buffer, std::mt19937& rng)
+{
+    const size_t LINE_LENGTH = 2u << 20;
+    auto random = [&](unsigned n) { return unsigned(rng() % n); };
+    char item[128];
+    buffer.push_back('[');
+    while (buffer.size() < LINE_LENGTH) {
+        int length = snprintf(item, sizeof(item), "{\"id\":%u,\"name\":\"item %u\",\"tags\":[\"a%u\",\"b%u\"],\"ok\":%s},",
+            unsigned(rng()), random(100000), random(10), random(10), random(2) ? "true" : "false");
+        buffer.append(item, length);
+    }
+    buffer.append("]\n");
+}
+
+// text mixing ASCII with 2-, 3- and 4-byte UTF-8 sequences
+static void fill_mixed_utf8(std::string& buffer, std::mt19937& rng)
+{
+    static const char* WORDS[] = { "naïve", "Grüße", "日本語の", "Привет", "😀", "text", "log", "ελληνικά", "über", "mixed" };
+    while (buffer.size() < (4u << 20)) {
+        auto words = 4 + rng() % 16;
+        for (unsigned i = 0; i < words; i++) {
+            buffer.append(WORDS[rng() % 10]);
+            buffer.push_back(' ');
+        }
+        buffer.back() = '\n';
+    }
+}
+
+// ---- measurements ---------------------------------------------------------
+
+/// Resets the peak resident set size of the process (Linux 4.0+), so
+/// that each case reports its own peak.
+static void reset_peak_rss()
+{
+    std::ofstream("/proc/self/clear_refs") << "5";
+}
+
+static double get_peak_rss_mb()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind("VmHWM:", 0) == 0) {
+            return std::stod(line.substr(6)) / 1024.0;
+        }
+    }
+    return 0.0;
+}
+
+/// Mean and 99th percentile of frame times, as a JSON object.
+static std::string frame_stats(std::vector<double> times)
+{
+    if (times.empty()) {
+        return "null";
+    }
+    std::sort(times.begin(), times.end());
+    double sum = 0.0;
+    for (auto t : times) {
+        sum += t;
+    }
+    auto p99 = times[std::min(times.size() - 1, times.size() * 99 / 100)];
+    std::ostringstream out;
+    out << "{\"frames\": " << times.size() << ", \"mean_ms\": " << sum / times.size() << ", \"p99_ms\": " << p99 << "}";
+    return out.str();
+}
+
+class BenchContext {
+public:
+    std::shared_ptr<sdl::Font> font;
+    std::unique_ptr<sdl::Window> window;
+    std::unique_ptr<sdl::Renderer> renderer;
+    Settings settings;
+};
+
+static std::string run_case(BenchContext& context, std::string const& name, std::string const& path)
+{
+    std::cerr << "bench: " << name << "\n";
+    reset_peak_rss();
+
+    // load, showing the first frame as soon as possible
+    auto start = Clock::now();
+    auto document = std::make_shared<Document>();
+    document->flag_use_index_cache = false;
+    document->load_in_background(path);
+    View view(document, context.font, context.renderer->get_output_size());
+    auto draw_frame = [&] {
+        auto frame_start = Clock::now();
+        view.render(*context.renderer, context.settings);
+        context.renderer->present();
+        return elapsed_ms(frame_start);
+    };
+    draw_frame();
+    double first_frame_ms = elapsed_ms(start);
+    while (document->is_loading()) {
+        usleep(1000);
+    }
+    double load_ms = elapsed_ms(start);
+    auto bytes = document->get_byte_size();
+    auto memory = document->get_memory_report();
+
+    // scripted scrolling, each step followed by a frame
+    auto run_script = [&](int steps, std::function<void(int)> const& step) {
+        std::vector<double> times;
+        for (int i = 0; i < steps; i++) {
+            step(i);
+            times.push_back(draw_frame());
+        }
+        return frame_stats(times);
+    };
+    std::mt19937 rng(1);
+    auto line_scroll = run_script(300, [&](int) { view.scroll_lines(1); });
+    auto page_scroll = run_script(100, [&](int) { view.scroll_lines(view.max_lines_shown); });
+    auto jumps = run_script(50, [&](int) { view.scroll_to_indicator(rng() % view.viewport_size.h); });
+    view.scroll_to_indicator(0);
+    auto horizontal_scroll = run_script(50, [&](int i) { view.scroll_blocks(i < 25 ? 1 : -1); });
+    view.set_wrap(true);
+    auto wrapped_scroll = run_script(100, [&](int) { view.scroll_lines(view.max_lines_shown); });
+    view.set_wrap(false);
+
+    // the same as line_scroll, with each line rendered whole into a texture
+    // (rasterized ahead by the workers, so the frames only upload them)
+    view.scroll_to_indicator(0);
+    context.settings.use_glyph_atlas = false;
+    auto texture_line_scroll = run_script(300, [&](int) { view.scroll_lines(1); });
+    context.settings = Settings();
+
+    std::ostringstream out;
+    out << "{\"name\": \"" << name << "\", \"bytes\": " << bytes << ", \"lines\": " << document->size()
+        << ", \"load_ms\": " << load_ms << ", \"load_mb_per_s\": " << (bytes / 1048576.0) / (load_ms / 1000.0)
+        << ", \"first_frame_ms\": " << first_frame_ms
+        << ", \"line_scroll\": " << line_scroll << ", \"page_scroll\": " << page_scroll
+        << ", \"jumps\": " << jumps << ", \"horizontal_scroll\": " << horizontal_scroll
+        << ", \"wrapped_scroll\": " << wrapped_scroll << ", \"texture_line_scroll\": " << texture_line_scroll
+        << ", \"index_bytes_per_line\": " << memory.get_bytes_per_line()
+        << ", \"index_overhead_ratio\": " << memory.get_overhead_ratio()
+        << ", \"peak_rss_mb\": " << get_peak_rss_mb() << "}";
+    return out.str();
+}
+
+// many small appends to the line index, as in follow mode (or one per
+// compressed block); each must take time in proportion to its own offsets,
+// not to the whole index
+static std::string run_small_appends()
+{
+    std::cerr << "bench: line_index_appends\n";
+    const size_t APPEND_COUNT = 20000, BATCH_SIZE = 64;
+    auto start = Clock::now();
+    LineOffsets offsets;
+    std::vector<uint64_t> batch(BATCH_SIZE);
+    uint64_t offset = 0u;
+    size_t reallocations = 0u;
+    for (size_t i = 0; i < APPEND_COUNT; i++) {
+        for (auto& line_start : batch) {
+            line_start = offset;
+            offset += 80;
+        }
+        auto old_memory = offsets.get_memory_usage();
+        offsets.append(batch);
+        reallocations += offsets.get_memory_usage() != old_memory;
+    }
+    auto append_ms = elapsed_ms(start);
+    if (offsets.size() != APPEND_COUNT * BATCH_SIZE || reallocations > 64) {
+        throw std::runtime_error("line index appends: " + std::to_string(reallocations) + " reallocations");
+    }
+
+    std::ostringstream out;
+    out << "{\"appends\": " << APPEND_COUNT << ", \"batch_size\": " << BATCH_SIZE
+        << ", \"append_ms\": " << append_ms << ", \"reallocations\": " << reallocations << "}";
+    return out.str();
+}
+
+int main(int argc, char** argv)
+{
+    // no display, no audio; everything is rendered in memory
+    setenv("SDL_VIDEODRIVER", "dummy", 1);
+    setenv("SDL_AUDIODRIVER", "dummy", 1);
+    sdl::auto_init();
+
+    std::string directory = argc > 1 ? argv[1] : "/tmp";
+    auto large_mb = getenv("BENCH_LARGE_MB") ? std::stoull(getenv("BENCH_LARGE_MB")) : 2048u;
+    auto font_path = getenv("BENCH_FONT") ? getenv("BENCH_FONT") : "/usr/share/fonts/liberation/LiberationMono-Regular.ttf";
+
+    BenchContext context;
+    context.font = std::make_shared<sdl::Font>(font_path, context.settings.font_size);
+    context.window = std::make_unique<sdl::Window>("bench", context.settings.initial_window_size);
+    context.renderer = std::make_unique<sdl::Renderer>(*context.window, SDL_RENDERER_SOFTWARE | SDL_RENDERER_TARGETTEXTURE);
+
+    class Input {
+    public:
+        std::string name;
+        uint64_t size;
+        void (*fill)(std::string&, std::mt19937&);
+    };
+    std::vector<Input> inputs = {
+        { "short_lines", 256u << 20, fill_short_lines },
+        { "long_lines", 64u << 20, fill_long_lines },
+        { "mixed_utf8", 128u << 20, fill_mixed_utf8 },
+    };
+    if (large_mb > 0) {
+        inputs.push_back({ "large", uint64_t(large_mb) << 20, fill_short_lines });
+    }
+
+    auto small_appends = run_small_appends();
+    std::vector<std::string> results;
+    for (auto& input : inputs) {
+        auto path = directory + "/bench_" + input.name + "_" + std::to_string(getpid()) + ".txt";
+        std::cerr << "bench: generating " << path << "\n";
+        std::mt19937 rng(42);
+        write_file(path, input.size, [&](std::string& buffer) { input.fill(buffer, rng); });
+        try {
+            results.push_back(run_case(context, input.name, path));
+        }
+        catch (...) {
+            unlink(path.c_str());
+            throw;
+        }
+        unlink(path.c_str());
+    }
+
+    std::cout << "{\"cases\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        std::cout << "  " << results[i] << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    std::cout << "], \"line_index_appends\": " << small_appends << "}\n";
+}
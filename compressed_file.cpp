@@ -0,0 +1,287 @@
+#include "compressed_file.hpp"
+#include <zlib.h>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+
+// how much history the deflate decoder needs to resume
+static const size_t WINDOW_SIZE = 32u << 10;
+
+// the output buffer of the scan (a multiple of the window)
+static const size_t SCAN_BUFFER_SIZE = 256u << 10;
+
+// zlib counts the input in 32 bits, so bigger files are fed in parts
+static const uint64_t MAX_INFLATE_INPUT = 1u << 30;
+
+static bool is_gzip_member(Bytef const* position, Bytef const* end)
+{
+    return end - position >= 2 && position[0] == 0x1f && position[1] == 0x8b;
+}
+
+static void feed_input(z_stream& strm, Bytef const* end)
+{
+    if (strm.avail_in == 0) {
+        strm.avail_in = uInt(std::min<uint64_t>(end - strm.next_in, MAX_INFLATE_INPUT));
+    }
+}
+
+bool CompressedFile::is_compressed(std::string const& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    unsigned char magic[2];
+    bool result = ::read(fd, magic, 2) == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+    close(fd);
+    return result;
+}
+
+CompressedFile::CompressedFile(std::string const& path)
+    : m_input(path)
+{
+}
+
+double CompressedFile::get_progress() const
+{
+    if (m_input.size() == 0) {
+        return 1.0;
+    }
+    return double(m_input_scanned) / m_input.size();
+}
+
+size_t CompressedFile::get_memory_usage() const
+{
+    std::lock_guard lock(m_mutex);
+    size_t usage = m_checkpoints.capacity() * sizeof(Checkpoint);
+    for (auto& checkpoint : m_checkpoints) {
+        usage += checkpoint.window ? WINDOW_SIZE : 0u;
+    }
+    for (auto& chunk : m_chunks) {
+        usage += sizeof(Chunk) + chunk.data->capacity();
+    }
+    return usage;
+}
+
+void CompressedFile::scan(std::function<void(uint64_t, std::string_view)> const& on_data, std::atomic<bool> const& cancel)
+{
+    auto input = m_input.get_bytes();
+    auto input_begin = reinterpret_cast<Bytef const*>(input.data());
+    auto input_end = input_begin + input.size();
+
+    z_stream strm {};
+    if (Z_OK != inflateInit2(&strm, 15 + 32)) {     // gzip or zlib header
+        throw std::runtime_error("inflateInit2() failed");
+    }
+    strm.next_in = const_cast<Bytef*>(input_begin);
+
+    {
+        // decompression can always start at the beginning
+        std::lock_guard lock(m_mutex);
+        m_checkpoints.assign(1, Checkpoint {});
+    }
+
+    // the output buffer is used round-robin, so that the last WINDOW_SIZE
+    // bytes are always in it when a checkpoint is saved
+    auto buffer = std::make_unique<unsigned char[]>(SCAN_BUFFER_SIZE);
+    uint64_t total_out = 0u, last_checkpoint = 0u;
+    while (!cancel) {
+        if (strm.avail_out == 0) {
+            strm.next_out = buffer.get();
+            strm.avail_out = SCAN_BUFFER_SIZE;
+        }
+        feed_input(strm, input_end);
+        if (strm.avail_in == 0) {
+            break;      // truncated file; keep what was decompressed
+        }
+
+        auto out_start = strm.next_out;
+        int ret = inflate(&strm, Z_BLOCK);
+        if (ret != Z_OK && ret != Z_STREAM_END) {
+            break;      // corrupt data; keep what was decompressed
+        }
+
+        size_t produced = strm.next_out - out_start;
+        if (produced > 0) {
+            on_data(total_out, std::string_view(reinterpret_cast<char const*>(out_start), produced));
+            total_out += produced;
+            m_size = total_out;
+        }
+        m_input_scanned = strm.next_in - input_begin;
+
+        if (ret == Z_STREAM_END) {
+
+            // a gzip file may consist of several members
+            if (is_gzip_member(strm.next_in, input_end)) {
+                inflateReset(&strm);
+                continue;
+            }
+            break;
+        }
+
+        // the decoder state can be saved between deflate blocks (bit 7),
+        // but not after the last one (bit 6)
+        bool at_block_end = (strm.data_type & 128) && !(strm.data_type & 64);
+        if (at_block_end && total_out - last_checkpoint >= CHECKPOINT_SPAN) {
+            Checkpoint checkpoint;
+            checkpoint.out_offset = total_out;
+            checkpoint.in_offset = strm.next_in - input_begin;
+            checkpoint.bits = strm.data_type & 7;
+            checkpoint.window = std::shared_ptr<unsigned char[]>(new unsigned char[WINDOW_SIZE]);
+
+            // the window may wrap around the end of the buffer
+            size_t end = strm.next_out - buffer.get();
+            auto window = checkpoint.window.get();
+            if (end >= WINDOW_SIZE) {
+                memcpy(window, buffer.get() + end - WINDOW_SIZE, WINDOW_SIZE);
+            }
+            else {
+                memcpy(window, buffer.get() + SCAN_BUFFER_SIZE - (WINDOW_SIZE - end), WINDOW_SIZE - end);
+                memcpy(window + WINDOW_SIZE - end, buffer.get(), end);
+            }
+
+            std::lock_guard lock(m_mutex);
+            m_checkpoints.push_back(checkpoint);
+            last_checkpoint = total_out;
+        }
+    }
+    inflateEnd(&strm);
+
+    if (!cancel) {
+        m_complete = true;
+    }
+}
+
+void CompressedFile::decompress(Checkpoint const& from, uint64_t offset, size_t length, std::string& output)
+{
+    auto input = m_input.get_bytes();
+    auto input_begin = reinterpret_cast<Bytef const*>(input.data());
+    auto input_end = input_begin + input.size();
+
+    // the start of the file has a header to read; elsewhere, a raw deflate
+    // stream is resumed with the saved bits and window
+    z_stream strm {};
+    bool is_raw = bool(from.window);
+    if (Z_OK != inflateInit2(&strm, is_raw ? -15 : 15 + 32)) {
+        throw std::runtime_error("inflateInit2() failed");
+    }
+    strm.next_in = const_cast<Bytef*>(input_begin + from.in_offset);
+    if (is_raw) {
+        if (from.bits) {
+            inflatePrime(&strm, from.bits, input_begin[from.in_offset - 1] >> (8 - from.bits));
+        }
+        inflateSetDictionary(&strm, from.window.get(), WINDOW_SIZE);
+    }
+
+    output.clear();
+    output.reserve(length);
+    auto discard = std::make_unique<unsigned char[]>(SCAN_BUFFER_SIZE);
+    uint64_t position = from.out_offset;
+    while (output.size() < length) {
+        feed_input(strm, input_end);
+        if (strm.avail_in == 0) {
+            break;
+        }
+
+        // the bytes before the offset are decompressed into a scratch buffer
+        size_t have = output.size();
+        if (position < offset) {
+            strm.next_out = discard.get();
+            strm.avail_out = uInt(std::min<uint64_t>(offset - position, SCAN_BUFFER_SIZE));
+        }
+        else {
+            output.resize(length);
+            strm.next_out = reinterpret_cast<Bytef*>(output.data() + have);
+            strm.avail_out = uInt(length - have);
+        }
+
+        auto out_start = strm.next_out;
+        int ret = inflate(&strm, Z_NO_FLUSH);
+        size_t produced = strm.next_out - out_start;
+        if (position >= offset) {
+            output.resize(have + produced);
+        }
+        position += produced;
+
+        if (ret == Z_STREAM_END) {
+
+            // a raw stream stops before the member trailer (CRC and size)
+            auto next = strm.next_in + (is_raw ? 8 : 0);
+            if (!is_gzip_member(next, input_end)) {
+                break;
+            }
+            inflateReset2(&strm, 15 + 32);
+            is_raw = false;
+            strm.next_in = const_cast<Bytef*>(next);
+            strm.avail_in = 0;
+        }
+        else if (ret != Z_OK) {
+            break;
+        }
+    }
+    inflateEnd(&strm);
+}
+
+std::shared_ptr<std::string const> CompressedFile::get_chunk(uint64_t index)
+{
+    Checkpoint from;
+    {
+        std::lock_guard lock(m_mutex);
+        for (auto it = m_chunks.begin(); it != m_chunks.end(); ++it) {
+            if (it->index == index) {
+                m_chunks.splice(m_chunks.begin(), m_chunks, it);
+                return it->data;
+            }
+        }
+        auto by_offset = [](uint64_t offset, Checkpoint const& checkpoint) { return offset < checkpoint.out_offset; };
+        from = *std::prev(std::upper_bound(m_checkpoints.begin(), m_checkpoints.end(), index * CHUNK_SIZE, by_offset));
+    }
+
+    // decompress without holding the lock, so that other threads can read meanwhile
+    auto data = std::make_shared<std::string>();
+    decompress(from, index * CHUNK_SIZE, CHUNK_SIZE, *data);
+
+    std::lock_guard lock(m_mutex);
+    m_chunks.push_front(Chunk { index, data });
+    if (m_chunks.size() > MAX_CACHED_CHUNKS) {
+        m_chunks.pop_back();
+    }
+    return data;
+}
+
+std::string_view CompressedFile::read(uint64_t offset, size_t length, std::string& buffer)
+{
+    buffer.clear();
+    uint64_t end = std::min<uint64_t>(offset + length, size());
+    if (offset >= end) {
+        return buffer;
+    }
+
+    // big reads (e.g. from a search) would just flush the cache, so they
+    // are decompressed straight from the nearest checkpoint
+    if (end - offset > CHUNK_SIZE) {
+        Checkpoint from;
+        {
+            std::lock_guard lock(m_mutex);
+            auto by_offset = [](uint64_t offset, Checkpoint const& checkpoint) { return offset < checkpoint.out_offset; };
+            from = *std::prev(std::upper_bound(m_checkpoints.begin(), m_checkpoints.end(), offset, by_offset));
+        }
+        decompress(from, offset, end - offset, buffer);
+        return buffer;
+    }
+
+    for (uint64_t position = offset; position < end; ) {
+        auto index = position / CHUNK_SIZE;
+        auto chunk = get_chunk(index);
+        auto chunk_offset = position - index * CHUNK_SIZE;
+        if (chunk_offset >= chunk->size()) {
+            break;
+        }
+        auto count = std::min<uint64_t>(chunk->size() - chunk_offset, end - position);
+        buffer.append(*chunk, chunk_offset, count);
+        position += count;
+    }
+    return buffer;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "document.hpp"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * A gzip-compressed file with random access to the uncompressed bytes.
+ *
+ * The file is decompressed once from start to end by scan(), which saves
+ * a checkpoint (the decoder state: position and the last 32 KiB of output)
+ * every CHECKPOINT_SPAN bytes. A read at any offset then decompresses only
+ * from the nearest checkpoint before it. Decompressed chunks are kept in
+ * a small LRU cache, so memory stays bounded regardless of the uncompressed
+ * size (apart from the checkpoints, about 0.4% of it).
+ */
+class CompressedFile {
+protected:
+    /// Where decompression can be resumed.
+    class Checkpoint {
+    public:
+        uint64_t out_offset = 0u;   ///< Uncompressed offset.
+        uint64_t in_offset = 0u;    ///< Compressed offset (of the first full byte).
+        int bits = 0;               ///< Bits of the preceding byte that belong to this point.
+        std::shared_ptr<unsigned char[]> window;    ///< Null for the start of the file.
+    };
+
+    /// A decompressed part of the file, CHUNK_SIZE long (except at the end).
+    class Chunk {
+    public:
+        uint64_t index;
+        std::shared_ptr<std::string const> data;
+    };
+
+    MappedFile m_input;
+    mutable std::mutex m_mutex;         ///< Guards the checkpoints and the chunks.
+    std::vector<Checkpoint> m_checkpoints;
+    std::list<Chunk> m_chunks;          ///< The most recently used go first.
+    std::atomic<uint64_t> m_size = 0u;  ///< Uncompressed bytes scanned so far.
+    std::atomic<uint64_t> m_input_scanned = 0u;
+    std::atomic<bool> m_complete = false;
+
+    std::shared_ptr<std::string const> get_chunk(uint64_t index);
+    void decompress(Checkpoint const& from, uint64_t offset, size_t length, std::string& output);
+public:
+    static const uint64_t CHECKPOINT_SPAN = 8u << 20;
+    static const uint64_t CHUNK_SIZE = 1u << 20;
+    static const size_t MAX_CACHED_CHUNKS = 32u;
+
+    /// Checks if the file starts with the gzip magic bytes.
+    static bool is_compressed(std::string const& path);
+
+    explicit CompressedFile(std::string const& path);
+    CompressedFile(CompressedFile& other) = delete;
+
+    /// Decompresses the whole file, saving the checkpoints and passing the
+    /// uncompressed bytes to `on_data` with their offset. Stops early
+    /// (leaving the file incomplete) when `cancel` gets set.
+    void scan(std::function<void(uint64_t, std::string_view)> const& on_data, std::atomic<bool> const& cancel);
+
+    /// Uncompressed size (as far as scanned).
+    uint64_t size() const { return m_size; }
+    bool is_complete() const { return m_complete; }
+
+    /// Fraction of the compressed input scanned so far.
+    double get_progress() const;
+
+    /// Returns the heap memory held by the checkpoints and the cached chunks, in bytes.
+    size_t get_memory_usage() const;
+
+    /// Reads the uncompressed bytes [offset, offset + length) into the buffer,
+    /// (clamped to the scanned size) and returns them.
+    std::string_view read(uint64_t offset, size_t length, std::string& buffer);
+};
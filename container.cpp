@@ -1,19 +1,72 @@
 #include "container.hpp"
 #include "widget.hpp"
+#include <algorithm>
+
+HContainer::~HContainer()
+{
+    for (auto& widget : m_widgets) {
+        widget->set_parent(nullptr);
+    }
+}
+
+void HContainer::insert(size_t index, std::shared_ptr<Widget> widget)
+{
+    widget->set_parent(this);
+    m_widgets.insert(m_widgets.begin() + index, widget);
+    invalidate_layout();
+}
+
+void HContainer::remove(std::shared_ptr<Widget> const& widget)
+{
+    widget->set_parent(nullptr);
+    m_widgets.erase(std::remove(m_widgets.begin(), m_widgets.end(), widget), m_widgets.end());
+    invalidate_layout();
+}
 
 void HContainer::layout()
 {
-    uint32_t total_min_width = 0, cap_height = 0;
-    for (auto widget : m_widgets) {
-        auto sizing_info = widget->get_sizing_info();
-        total_min_width += sizing_info.min_width;
-        cap_height = std::max(cap_height, sizing_info.min_height);
+    // the sizing info of the elements (and the sums below) are cached,
+    // so a relayout only redoes the arithmetic
+    auto& sizing_info = get_sizing_info();
+    size_t growing_count = 0;
+    for (auto& widget : m_widgets) {
+        growing_count += widget->get_sizing_info().grow_x ? 1 : 0;
     }
 
-    sdl::Point2d topleft;
-    for (auto widget : m_widgets) {
-        auto sizing_rules = widget->get_sizing_info();
-        widget->set_rect(sdl::Rect(topleft, sdl::Size2d(sizing_rules.min_width, cap_height)));
-        topleft.x += sizing_rules.min_width;
+    // the room left over the minimum widths goes to the growable widgets
+    uint32_t extra_width = (m_rect.w > int(sizing_info.min_width)) ? m_rect.w - sizing_info.min_width : 0;
+    size_t growing_index = 0;
+    sdl::Point2d topleft(m_rect.x, m_rect.y);
+    for (auto& widget : m_widgets) {
+        auto& widget_info = widget->get_sizing_info();
+        uint32_t width = widget_info.min_width;
+        if (widget_info.grow_x) {
+            width += extra_width / growing_count + (growing_index < extra_width % growing_count ? 1 : 0);
+            growing_index++;
+        }
+        int height = widget_info.grow_y ? m_rect.h : std::min<int>(widget_info.min_height, m_rect.h);
+        widget->set_rect(sdl::Rect(topleft, sdl::Size2d(width, height)));
+        topleft.x += width;
+    }
+}
+
+void HContainer::render(sdl::Renderer& renderer, Settings& settings)
+{
+    for (auto& widget : m_widgets) {
+        widget->render(renderer, settings);
+    }
+    m_dirty = false;
+}
+
+WidgetSizingInfo HContainer::calc_sizing_info()
+{
+    WidgetSizingInfo sizing_info { .min_width = 0u, .min_height = 0u, .grow_x = false, .grow_y = false };
+    for (auto& widget : m_widgets) {
+        auto& widget_info = widget->get_sizing_info();
+        sizing_info.min_width += widget_info.min_width;
+        sizing_info.min_height = std::max(sizing_info.min_height, widget_info.min_height);
+        sizing_info.grow_x = sizing_info.grow_x || widget_info.grow_x;
+        sizing_info.grow_y = sizing_info.grow_y || widget_info.grow_y;
     }
+    return sizing_info;
 }
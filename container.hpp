@@ -4,21 +4,27 @@
 #include <vector>
 
 class Container : public virtual Widget {
-public:
-    virtual void layout() = 0;
 };
 
 /**
  * Lays out its elements horizontally. Width of each widget is derived
  * from the minimum width, and if extra room is available, it is divided
- * evenly between growable widgets.
+ * evenly between growable widgets. The widgets growable in Y take the full
+ * height, the others their minimum height (at the top).
  */
 class HContainer : public virtual Container {
 protected:
     std::vector<std::shared_ptr<Widget>> m_widgets;
-public:
-    void add(std::shared_ptr<Widget> widget) { m_widgets.push_back(widget); }
+
     void layout() override;
+    WidgetSizingInfo calc_sizing_info() override;
+public:
+    ~HContainer();
+
+    void add(std::shared_ptr<Widget> widget) { insert(m_widgets.size(), widget); }
+    void insert(size_t index, std::shared_ptr<Widget> widget);
+    void remove(std::shared_ptr<Widget> const& widget);
+    std::vector<std::shared_ptr<Widget>> const& get_widgets() const { return m_widgets; }
+
     void render(sdl::Renderer& renderer, Settings& settings) override;
-    WidgetSizingInfo get_sizing_info() override;
 };
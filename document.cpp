@@ -1,4 +1,9 @@
 #include "document.hpp"
+#include "compressed_file.hpp"
+#include "index_cache.hpp"
+#include "line_index.hpp"
+#include "trace.hpp"
+#include "utf8.hpp"
 #include <cstring>
 #include <unistd.h>
 #include <fcntl.h>
@@ -7,80 +12,598 @@
 #include <sys/mman.h>
 #include <cassert>
 #include <iostream>
-#include <sstream>
+#include <utility>
+#include <algorithm>
+#include <mutex>
 
-void Document::add_line()
+// ---- MappedFile -----------------------------------------------------------
+
+// how much address space is reserved for the file to grow into
+static const size_t GROWTH_RESERVE = sizeof(void*) >= 8 ? size_t(64) << 30 : size_t(64) << 20;
+
+MappedFile::MappedFile(std::string const& path)
+{
+    m_fd = open(path.c_str(), O_RDONLY);
+    if (m_fd < 0) {
+        throw std::runtime_error("could not open file for reading: " + path);
+    }
+
+    struct stat st;
+    if (0 != fstat(m_fd, &st)) {
+        close();
+        throw std::runtime_error("could not stat file: " + path);
+    }
+
+    // reserve the address range first, then map the file over its start
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    m_reserved = (size_t(st.st_size) + GROWTH_RESERVE + page_size - 1) / page_size * page_size;
+    void* base = mmap(nullptr, m_reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        m_reserved = 0;
+        close();
+        throw std::runtime_error("could not reserve memory for file: " + path);
+    }
+    m_data = static_cast<char const*>(base);
+    if (!extend(st.st_size)) {
+        close();
+        throw std::runtime_error("could not map file to memory: " + path);
+    }
+}
+
+MappedFile::MappedFile(MappedFile&& other)
+    : m_fd(std::exchange(other.m_fd, -1)),
+      m_data(std::exchange(other.m_data, nullptr)),
+      m_size(std::exchange(other.m_size, 0)),
+      m_reserved(std::exchange(other.m_reserved, 0))
 {
-    m_lines.push_back(Line());
 }
 
-void Document::add_piece(TextPiece&& piece)
+MappedFile& MappedFile::operator=(MappedFile&& other)
 {
-    if (m_lines.empty()) {
-        m_lines.push_back(Line());
+    if (this != &other) {
+        close();
+        m_fd = std::exchange(other.m_fd, -1);
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+        m_reserved = std::exchange(other.m_reserved, 0);
+    }
+    return *this;
+}
+
+void MappedFile::close()
+{
+    if (m_data) {
+        munmap(const_cast<char*>(m_data), m_reserved);
+        m_data = nullptr;
+    }
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    m_size = 0;
+    m_reserved = 0;
+}
+
+bool MappedFile::extend(size_t new_size)
+{
+    if (new_size <= m_size) {
+        return true;
+    }
+    if (new_size > m_reserved) {
+        return false;
+    }
+
+    // map from the page holding the current end (it may have been partial)
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t offset = m_size / page_size * page_size;
+    void* target = const_cast<char*>(m_data) + offset;
+    void* mapped = mmap(target, new_size - offset, PROT_READ, MAP_PRIVATE | MAP_FIXED, m_fd, offset);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    m_size = new_size;
+    return true;
+}
+
+size_t MappedFile::get_file_size() const
+{
+    struct stat st;
+    if (0 != fstat(m_fd, &st)) {
+        return m_size;
+    }
+    return st.st_size;
+}
+
+bool MappedFile::is_replaced(std::string const& path) const
+{
+    // while there is no file at the path (e.g. in the middle of a rotation),
+    // keep the one we have
+    struct stat current, opened;
+    if (0 != stat(path.c_str(), &current) || 0 != fstat(m_fd, &opened)) {
+        return false;
+    }
+    return current.st_ino != opened.st_ino || current.st_dev != opened.st_dev;
+}
+
+// ---- Document -------------------------------------------------------------
+
+Document::Document()
+{
+}
+
+Document::~Document()
+{
+    stop_loading();
+}
+
+void Document::open(std::string path)
+{
+    trace::Scope scope("Document::open");
+    std::unique_lock lock(m_mutex);
+    m_path = path;
+    m_compressed.reset();
+    m_file = MappedFile();
+    if (CompressedFile::is_compressed(path)) {
+        m_compressed = std::make_unique<CompressedFile>(path);
+    }
+    else {
+        m_file = MappedFile(path);
+    }
+    m_line_offsets.clear();
+    m_line_offsets.push_back(0);
+    m_scan_position = 0;
+    m_validated_position = 0;
+    m_validated_start = 0;
+    m_invalid_lines.clear();
+
+    // a cached index spares scanning (and validating) the bytes it covers;
+    // the validation goes on from the last line start, which may be partial
+    if (!m_compressed && flag_use_index_cache) {
+        m_scan_position = IndexCache(path).load_line_starts(m_file.get_bytes(), m_line_offsets);
+        m_validated_start = m_validated_position = m_line_offsets.back();
     }
-    m_lines.back().pieces.push_back(std::move(piece));
 }
 
 void Document::load(std::string path)
 {
-    FILE* f = fopen(path.c_str(), "rb");
-    if (!f) {
-        throw std::runtime_error("could not open file for reading: " + path);
+    trace::Scope scope("Document::load");
+    stop_loading();
+    open(path);
+
+    // compressed files cannot be indexed lazily
+    if (m_compressed) {
+        index_compressed();
     }
+}
 
-    for(;;) {
-        Line line;
-        auto c = fgetc(f);
+void Document::load_in_background(std::string path)
+{
+    stop_loading();
+    open(path);
+    m_loading = true;
+    m_loader = std::thread([this] { run_loader(); });
+}
 
-        // line per line
-        int column = 0;
-        std::stringstream buf;
-        for(;;) {
-            if (flag_coalesce_spaces && (c == ' ' || c == '\t')) {
+// how much of the file is scanned at once when indexing lazily
+static const uint64_t INDEX_BLOCK_SIZE = 256u << 10;
 
-                // skip a run of whitespaces
-                while (c == ' ' || c == '\t') {
-                    c = fgetc(f);
-                }
-                ungetc(c, f);
+// how much of the file the loader thread scans at first; the blocks then
+// grow, so that the first screenful appears quickly but the rest is
+// indexed at full speed
+static const uint64_t FIRST_LOAD_BLOCK_SIZE = 64u << 10;
+static const uint64_t MAX_LOAD_BLOCK_SIZE = 64u << 20;
 
-                if (!buf.str().empty()) {
-                    TextPiece piece(buf.str());
-                    add_piece(std::move(piece));
-                }
-                buf = std::stringstream();
-            }
-            else if (c == '\n' || c == EOF) {
-                if (!buf.str().empty()) {
-                    TextPiece piece(buf.str());
-                    add_piece(std::move(piece));
-                }
-                add_line();
-                buf = std::stringstream();
-                break;
-            }
-            else if (c < ' ') {     // nonprintable characters
-                buf.put('?');
+// how many decompressed bytes are indexed before the lines are published
+static const uint64_t COMPRESSED_PUBLISH_SIZE = 1u << 20;
+
+void Document::run_loader()
+{
+    trace::Scope scope("Document::run_loader");
+    if (m_compressed) {
+        index_compressed();
+        m_loading = false;
+        return;
+    }
+
+    uint64_t start = m_scan_position;
+    uint64_t block_size = FIRST_LOAD_BLOCK_SIZE;
+    std::vector<uint64_t> block_offsets;
+    while (!m_cancel_loading && !is_fully_indexed()) {
+
+        // scan the next block without holding the lock...
+        trace::Scope block_scope("Document::index_block");
+        uint64_t position = m_scan_position;
+        auto block = m_file.get_bytes().substr(position, block_size);
+        block_offsets.clear();
+        find_line_starts_parallel(block, position, block_offsets);
+        uint64_t validated_end;
+        auto invalid_offsets = find_invalid_utf8(position + block.size(), validated_end);
+
+        // ...and publish its lines
+        {
+            std::unique_lock lock(m_mutex);
+            m_line_offsets.append(block_offsets);
+            m_scan_position = position + block.size();
+            mark_invalid_utf8(invalid_offsets, validated_end);
+        }
+        block_size = std::min(block_size * 2, MAX_LOAD_BLOCK_SIZE);
+    }
+
+    m_loading = false;
+
+    // (after the loading is over, so that nobody waits for the cache)
+    if (!m_cancel_loading && flag_use_index_cache && m_scan_position > start) {
+        trace::Scope save_scope("IndexCache::save_line_starts");
+        std::shared_lock lock(m_mutex);
+        IndexCache(m_path).save_line_starts(m_file.get_bytes(), m_line_offsets);
+    }
+}
+
+void Document::index_compressed()
+{
+    trace::Scope scope("Document::index_compressed");
+    std::vector<uint64_t> offsets;
+    uint64_t scanned = 0u;
+    auto publish = [&] {
+        std::unique_lock lock(m_mutex);
+        m_line_offsets.append(offsets);
+        m_scan_position = scanned;
+        offsets.clear();
+    };
+
+    m_compressed->scan([&](uint64_t offset, std::string_view bytes) {
+        find_line_starts(bytes, offset, offsets);
+        scanned = offset + bytes.size();
+        if (scanned - m_scan_position >= COMPRESSED_PUBLISH_SIZE) {
+            publish();
+        }
+    }, m_cancel_loading);
+    publish();
+}
+
+void Document::stop_loading()
+{
+    m_cancel_loading = true;
+    if (m_loader.joinable()) {
+        m_loader.join();
+    }
+    m_cancel_loading = false;
+    m_loading = false;
+}
+
+double Document::get_load_progress() const
+{
+    if (m_compressed) {
+        return m_compressed->get_progress();
+    }
+    if (m_file.size() == 0) {
+        return 1.0;
+    }
+    return double(m_scan_position) / m_file.size();
+}
+
+Document::Change Document::refresh()
+{
+    if (is_loading() || m_compressed) {
+        return Change::None;
+    }
+
+    // truncated or rotated files are simply loaded again, in the background
+    // like the first time (and with the index cache)
+    auto file_size = m_file.get_file_size();
+    if (m_file.is_replaced(m_path) || file_size < m_file.size()) {
+        load_in_background(m_path);
+        return Change::Reopened;
+    }
+    if (file_size == m_file.size()) {
+        return Change::None;
+    }
+
+    {
+        std::unique_lock lock(m_mutex);
+        bool was_fully_indexed = is_fully_indexed();
+        if (m_file.extend(file_size)) {
+
+            // a lazily indexed document indexes the new bytes when it gets to them
+            if (was_fully_indexed) {
+                index_all();
             }
-            else {
-                buf.put(c);
-                column++;
+            return Change::Appended;
+        }
+    }
+
+    // no more room to grow in place
+    load_in_background(m_path);
+    return Change::Reopened;
+}
+
+void Document::index_up_to(size_t number)
+{
+    if (m_compressed) {
+        return;     // indexed when loaded
+    }
+    auto bytes = m_file.get_bytes();
+
+    // line N is complete once the start of line N+1 is known
+    std::vector<uint64_t> block_offsets;
+    while (m_line_offsets.size() <= number + 1 && !is_fully_indexed()) {
+        auto block = bytes.substr(m_scan_position, INDEX_BLOCK_SIZE);
+        block_offsets.clear();
+        find_line_starts(block, m_scan_position, block_offsets);
+        m_line_offsets.append(block_offsets);
+        m_scan_position += block.size();
+    }
+    validate_scanned();
+}
+
+void Document::index_all()
+{
+    if (m_compressed) {
+        return;
+    }
+
+    // in blocks, so that the full-width offsets are never all in memory at once
+    std::vector<uint64_t> block_offsets;
+    while (!is_fully_indexed()) {
+        auto block = m_file.get_bytes().substr(m_scan_position, MAX_LOAD_BLOCK_SIZE);
+        block_offsets.clear();
+        find_line_starts_parallel(block, m_scan_position, block_offsets);
+        m_line_offsets.append(block_offsets);
+        m_scan_position += block.size();
+    }
+    validate_scanned();
+}
+
+std::vector<uint64_t> Document::find_invalid_utf8(uint64_t end, uint64_t& validated_end) const
+{
+    trace::Scope scope("Document::find_invalid_utf8");
+    auto bytes = m_file.get_bytes().substr(0, end);
+
+    // a sequence cut by the end is left for the next time
+    for (uint64_t back = 1; back <= 3 && back <= end; back++) {
+        auto byte = static_cast<uint8_t>(bytes[end - back]);
+        if (byte < 0x80) {
+            break;
+        }
+        if (byte >= 0xc0) {
+            uint64_t length = (byte >= 0xf0) ? 4 : (byte >= 0xe0) ? 3 : 2;
+            if (back < length) {
+                end -= back;
             }
-            c = fgetc(f);
+            break;
+        }
+    }
+
+    std::vector<uint64_t> offsets;
+    uint64_t position = m_validated_position;
+    while (position < end) {
+        auto invalid = position + utf8::find_invalid(bytes.substr(position, end - position));
+        if (invalid >= end) {
+            break;
+        }
+        offsets.push_back(invalid);
+
+        // the rest of the line is replaced anyway
+        auto eol = static_cast<char const*>(memchr(bytes.data() + invalid, '\n', end - invalid));
+        position = eol ? (eol - bytes.data()) + 1 : end;
+    }
+    validated_end = std::max<uint64_t>(end, m_validated_position);
+    return offsets;
+}
+
+void Document::mark_invalid_utf8(std::vector<uint64_t> const& offsets, uint64_t validated_end)
+{
+    for (auto offset : offsets) {
+        auto number = m_line_offsets.find_line(offset);
+        if (m_invalid_lines.empty() || m_invalid_lines.back() < number) {
+            m_invalid_lines.push_back(number);
+        }
+    }
+    m_validated_position = validated_end;
+}
+
+void Document::validate_scanned()
+{
+    uint64_t validated_end;
+    auto offsets = find_invalid_utf8(m_scan_position, validated_end);
+    mark_invalid_utf8(offsets, validated_end);
+}
+
+bool Document::has_invalid_utf8(size_t number, std::string_view text) const
+{
+    {
+        std::shared_lock lock(m_mutex);
+        if (!m_compressed && m_line_offsets[number] >= m_validated_start && get_line_end(number) <= m_validated_position) {
+            return std::binary_search(m_invalid_lines.begin(), m_invalid_lines.end(), number);
+        }
+    }
+    return utf8::find_invalid(text) < text.size();
+}
+
+bool Document::is_fully_indexed() const
+{
+    // a compressed file is complete once its last lines are published too
+    if (m_compressed) {
+        return m_compressed->is_complete() && m_scan_position >= m_compressed->size();
+    }
+    return m_scan_position >= m_file.size();
+}
+
+bool Document::is_line_indexed(size_t number) const
+{
+    // the last line known is complete only once the whole file is scanned
+    return number + 1 < m_line_offsets.size() || (number < m_line_offsets.size() && is_fully_indexed());
+}
+
+uint64_t Document::get_line_end(size_t number) const
+{
+    return (number + 1 < m_line_offsets.size()) ? m_line_offsets[number + 1] - 1 : get_byte_size();
+}
+
+std::string_view Document::slice_line(size_t number) const
+{
+    uint64_t start = m_line_offsets[number];
+    uint64_t end = get_line_end(number);
+    if (m_compressed) {
+        thread_local std::string buffer;
+        return m_compressed->read(start, end - start, buffer);
+    }
+    return m_file.get_bytes().substr(start, end - start);
+}
+
+size_t Document::size()
+{
+    {
+        std::shared_lock lock(m_mutex);
+        if (is_fully_indexed()) {
+            return m_line_offsets.size();
+        }
+        if (is_loading()) {
+            return m_line_offsets.size() - 1;
+        }
+    }
+
+    std::unique_lock lock(m_mutex);
+    index_all();
+    return m_line_offsets.size();
+}
+
+size_t Document::get_line_length(size_t number)
+{
+    std::shared_lock lock(m_mutex);
+    if (!is_line_indexed(number)) {
+        lock.unlock();
+        get_line_text(number);      // indexes the line, or throws
+        lock.lock();
+    }
+    return get_line_end(number) - m_line_offsets[number];
+}
+
+std::vector<uint32_t> Document::get_line_lengths(size_t first, size_t last) const
+{
+    std::shared_lock lock(m_mutex);
+    last = std::min(last, m_line_offsets.size());
+    std::vector<uint32_t> lengths;
+    lengths.reserve(last > first ? last - first : 0);
+    for (auto i = first; i < last; i++) {
+        lengths.push_back(std::min<uint64_t>(get_line_end(i) - m_line_offsets[i], UINT32_MAX));
+    }
+    return lengths;
+}
+
+uint64_t Document::get_line_offset(size_t number)
+{
+    std::shared_lock lock(m_mutex);
+    if (!is_line_indexed(number)) {
+        lock.unlock();
+        get_line_text(number);
+        lock.lock();
+    }
+    return m_line_offsets[number];
+}
+
+std::string_view Document::get_line_text(size_t number)
+{
+    {
+        std::shared_lock lock(m_mutex);
+        if (is_line_indexed(number)) {
+            return slice_line(number);
+        }
+    }
+
+    // while the loader runs, it is the only one indexing
+    if (!is_loading()) {
+        std::unique_lock lock(m_mutex);
+        index_up_to(number);
+        if (is_line_indexed(number)) {
+            return slice_line(number);
         }
-        if (c == EOF) break;
     }
-    fclose(f);
+    throw std::out_of_range("line not found: #" + std::to_string(number));
+}
+
+size_t Document::get_line_at_offset(uint64_t offset)
+{
+    if (offset >= m_scan_position && !is_loading()) {
+        std::unique_lock lock(m_mutex);
+        index_all();
+    }
+
+    std::shared_lock lock(m_mutex);
+    return m_line_offsets.find_line(offset);
+}
+
+uint64_t Document::get_byte_size() const
+{
+    return m_compressed ? m_compressed->size() : m_file.size();
+}
+
+std::string_view Document::read(uint64_t offset, size_t length, std::string& buffer) const
+{
+    if (m_compressed) {
+        return m_compressed->read(offset, length, buffer);
+    }
+    std::shared_lock lock(m_mutex);
+    auto bytes = m_file.get_bytes();
+    return offset < bytes.size() ? bytes.substr(offset, length) : std::string_view();
+}
+
+Document::MemoryReport Document::get_memory_report() const
+{
+    std::shared_lock lock(m_mutex);
+    MemoryReport report;
+    report.line_count = m_line_offsets.size();
+    report.byte_size = get_byte_size();
+    report.index_bytes = m_line_offsets.get_memory_usage() + m_invalid_lines.capacity() * sizeof(size_t);
+    report.decompression_bytes = m_compressed ? m_compressed->get_memory_usage() : 0u;
+    return report;
 }
 
-Line& Document::get_line(int number)
+Line Document::get_line(int number)
 {
     if (number < 0) {
         throw std::out_of_range("invalid line number: #" + std::to_string(number));
     }
-    if (size_t(number) < m_lines.size()) {
-        return m_lines.at(number);
+    auto original = get_line_text(number);
+
+    Line line;
+
+    // invalid UTF-8 is replaced with U+FFFD (which changes the length)...
+    std::string sanitized;
+    if (has_invalid_utf8(number, original)) {
+        sanitized = utf8::sanitize(original);
+        original = sanitized;
     }
-    throw std::out_of_range("line not found: #" + std::to_string(number));
+    auto text = original;
+
+    // ...and nonprintable characters in a private copy of the line;
+    // otherwise, the pieces point straight into the mapped file (the text
+    // of a compressed file is always copied, it is in a temporary buffer)
+    auto is_nonprintable = [](char c) { return static_cast<unsigned char>(c) < ' '; };
+    if (m_compressed || !sanitized.empty() || std::any_of(text.begin(), text.end(), is_nonprintable)) {
+        line.m_altered_text = std::make_unique<char[]>(text.size());
+        std::replace_copy_if(text.begin(), text.end(), line.m_altered_text.get(), is_nonprintable, '?');
+        text = std::string_view(line.m_altered_text.get(), text.size());
+    }
+    line.m_text = text;
+
+    if (!flag_coalesce_spaces) {
+        if (!text.empty()) {
+            line.pieces.emplace_back(text);
+        }
+        return line;
+    }
+
+    // a run of whitespaces separates pieces (tabs may have been replaced
+    // above, so the original bytes are checked for them)
+    size_t start = 0;
+    for (size_t i = 0; i <= text.size(); i++) {
+        if (i == text.size() || original[i] == ' ' || original[i] == '\t') {
+            if (i > start) {
+                line.pieces.emplace_back(text.substr(start, i - start));
+            }
+            start = i + 1;
+        }
+    }
+    return line;
 }
@@ -1,40 +1,251 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
+#include "line_index.hpp"
 
 /// A piece (a run, a sequence) of text with the same format.
+/// The piece does not own the text; it is a view into the document buffer
+/// (or into the line, if the line had to be altered).
 class TextPiece {
 protected:
-    std::string m_text;
+    std::string_view m_text;
 public:
-    TextPiece();
-    explicit TextPiece(std::string const& text) : m_text(text) {}
+    TextPiece() {}
+    explicit TextPiece(std::string_view text) : m_text(text) {}
     TextPiece(TextPiece& other) = delete;
     TextPiece(TextPiece&& other) = default;
     bool empty() const { return m_text.empty(); }
-    std::string get_text() const { return m_text; }
+    std::string_view get_text() const { return m_text; }
 };
 
 class Line {
+protected:
+    /// Own copy of the text, present only if the original bytes had to be altered.
+    std::unique_ptr<char[]> m_altered_text;
+
+    /// The whole text of the line (the pieces point into it).
+    std::string_view m_text;
 public:
     std::vector<TextPiece> pieces;
     Line() {}
     Line(Line& other) = delete;
     Line(Line&& other) = default;
     bool empty() const { return pieces.empty(); }
+    std::string_view get_text() const { return m_text; }
+
+    /// Returns the offset of the piece from the line start, in bytes.
+    size_t get_offset(TextPiece const& piece) const { return piece.get_text().data() - m_text.data(); }
+
+    friend class Document;
 };
 
+class CompressedFile;
+
+/**
+ * A read-only memory mapping of a whole file. Address space is reserved
+ * past the end of the file, so that when the file grows, the new part
+ * can be mapped in place with extend() while the existing addresses
+ * stay valid.
+ */
+class MappedFile {
+protected:
+    int m_fd = -1;
+    char const* m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_reserved = 0;      ///< Size of the reserved address range.
+
+    void close();
+public:
+    MappedFile() {}
+    explicit MappedFile(std::string const& path);
+    MappedFile(MappedFile& other) = delete;
+    MappedFile(MappedFile&& other);
+    MappedFile& operator=(MappedFile&& other);
+    ~MappedFile() { close(); }
+    size_t size() const { return m_size; }
+    std::string_view get_bytes() const { return std::string_view(m_data, m_size); }
+
+    /// Returns the current size of the file (which may differ from the mapped size).
+    size_t get_file_size() const;
+
+    /// Checks if the path now refers to a different file (e.g. after log rotation).
+    bool is_replaced(std::string const& path) const;
+
+    /// Maps the file up to the new (bigger) size, keeping the existing
+    /// addresses. Returns false if it does not fit in the reserved range.
+    bool extend(size_t new_size);
+};
+
+/**
+ * A text document backed by a memory-mapped file. Only a compact array
+ * of line start offsets (LineOffsets, 4 bytes per line) is kept in memory;
+ * the text of a line is sliced straight out of the mapping when requested.
+ *
+ * The document can be loaded in two ways. With load(), the offsets are
+ * indexed lazily, block by block, just as far as the lines asked for so
+ * far; the rest of the file is indexed in parallel when the full line
+ * count is needed. With load_in_background(), a loader thread indexes the
+ * whole file while the document is already in use; it grows as the lines
+ * are indexed, and size() returns just the lines indexed so far.
+ *
+ * The line index is guarded by a lock, so the document can be read
+ * from several threads at once.
+ *
+ * For following a growing file, refresh() indexes just the bytes appended
+ * since the last time, and reopens the file if it was truncated or replaced
+ * (loading it in background, as a rotated log may be as big as the first).
+ *
+ * The line index of a big file is saved to an IndexCache when the loader
+ * finishes, so the next time, only the bytes appended since are scanned.
+ *
+ * The bytes are checked for invalid UTF-8 as they are indexed, and get_line()
+ * replaces the invalid sequences of the lines found with U+FFFD, so that
+ * the text drawn is always valid. (The lines not checked while indexing,
+ * i.e. those of a compressed file, or those covered by a cached index
+ * when loading lazily, are checked one by one in get_line().)
+ *
+ * A gzip-compressed file is decompressed once while indexing (even with
+ * load(), as its line count cannot be known otherwise), and then read
+ * through a CompressedFile, which decompresses only the parts needed.
+ */
 class Document {
 protected:
-    std::vector<Line> m_lines;
+    std::string m_path;
+    MappedFile m_file;
+    std::unique_ptr<CompressedFile> m_compressed;   ///< Used instead of m_file for compressed files.
+
+    /// Guards the line index.
+    mutable std::shared_mutex m_mutex;
+
+    /// Start offset of every line indexed so far.
+    LineOffsets m_line_offsets;
+
+    /// Position up to which the file has been scanned for line ends.
+    std::atomic<uint64_t> m_scan_position = 0;
+
+    /// Position up to which the file has been checked for invalid UTF-8,
+    /// from m_validated_start (the bytes before it, covered by a cached
+    /// index, are not checked up front; their lines are checked when read).
+    std::atomic<uint64_t> m_validated_position = 0;
+    uint64_t m_validated_start = 0;
+
+    /// Numbers of the lines with invalid UTF-8 among the bytes checked (sorted).
+    std::vector<size_t> m_invalid_lines;
+
+    std::thread m_loader;
+    std::atomic<bool> m_loading = false;
+    std::atomic<bool> m_cancel_loading = false;
+
+    bool is_fully_indexed() const;
+    bool is_line_indexed(size_t number) const;
+    uint64_t get_line_end(size_t number) const;
+    std::string_view slice_line(size_t number) const;
+
+    /// Checks the bytes from m_validated_position up to `end` (or up to
+    /// the sequence cut by it) for invalid UTF-8. Returns the offsets of
+    /// the invalid sequences, just the first one of each line, and sets
+    /// `validated_end` to where the check ended.
+    std::vector<uint64_t> find_invalid_utf8(uint64_t end, uint64_t& validated_end) const;
+    bool has_invalid_utf8(size_t number, std::string_view text) const;
 
-    void add_line();
-    void add_piece(TextPiece&& piece);
+    // these are called with the lock held exclusively
+    void index_up_to(size_t number);
+    void index_all();
+    void mark_invalid_utf8(std::vector<uint64_t> const& offsets, uint64_t validated_end);
+    void validate_scanned();
+
+    void open(std::string path);
+    void run_loader();
+    void index_compressed();
+    void stop_loading();
 public:
+    /// What refresh() has found.
+    enum class Change {
+        None,
+        Appended,       ///< New bytes were appended (possibly finishing the last line).
+        Reopened        ///< The file was truncated or replaced, and is being loaded again in background.
+    };
+
+    /// How much memory the document takes, apart from the mapped file.
+    class MemoryReport {
+    public:
+        size_t line_count = 0u;
+        uint64_t byte_size = 0u;        ///< Document bytes (mapped, or decompressed on demand).
+        size_t index_bytes = 0u;        ///< Heap memory of the line index.
+        size_t decompression_bytes = 0u;    ///< Checkpoints and cached chunks of a compressed file.
+
+        size_t get_heap_bytes() const { return index_bytes + decompression_bytes; }
+        double get_bytes_per_line() const { return line_count ? double(get_heap_bytes()) / line_count : 0.0; }
+
+        /// Heap memory relative to the document bytes.
+        double get_overhead_ratio() const { return byte_size ? double(get_heap_bytes()) / byte_size : 0.0; }
+    };
+
     bool flag_coalesce_spaces = false;
-    Document() {}
+    bool flag_use_index_cache = true;
+    Document();
+    Document(Document& other) = delete;
+    ~Document();
+
     void load(std::string path);
-    size_t size() const { return m_lines.size(); }
-    Line& get_line(int number);
+    void load_in_background(std::string path);
+
+    std::string const& get_path() const { return m_path; }
+    bool is_compressed() const { return bool(m_compressed); }
+
+    /// Is the loader thread still indexing the file?
+    bool is_loading() const { return m_loading; }
+
+    /// Returns the fraction of the file indexed so far (0.0 to 1.0).
+    double get_load_progress() const;
+
+    /// Checks the file for changes and takes in the appended bytes.
+    /// The cost is proportional to the appended bytes, not to the file size.
+    /// Does nothing while loading in background. If the file was reopened,
+    /// all text obtained from the document before is invalid.
+    Change refresh();
+
+    /// Returns the number of lines. While loading in background, this is
+    /// the number of lines indexed so far; otherwise, this finishes
+    /// the line index if needed.
+    size_t size();
+
+    /// Returns the raw bytes of the line, without the line terminator.
+    /// For a compressed file, the bytes are in a per-thread buffer,
+    /// valid until the next call from the same thread.
+    std::string_view get_line_text(size_t number);
+
+    /// Returns the length of the line in bytes, without the line terminator.
+    size_t get_line_length(size_t number);
+
+    /// Returns the lengths of the (indexed) lines [first, last) like
+    /// get_line_length(), clamped to 32 bits, under one lock.
+    std::vector<uint32_t> get_line_lengths(size_t first, size_t last) const;
+
+    /// Returns the offset of the line start in the document bytes.
+    uint64_t get_line_offset(size_t number);
+
+    /// Returns the number of the (indexed) line containing the byte at the offset.
+    size_t get_line_at_offset(uint64_t offset);
+
+    /// Returns the number of document bytes available so far
+    /// (decompressed, for a compressed file).
+    uint64_t get_byte_size() const;
+
+    /// Returns the document bytes [offset, offset + length), clamped to
+    /// the bytes available. They are a view into the mapped file, or, for
+    /// a compressed file, decompressed into the buffer.
+    std::string_view read(uint64_t offset, size_t length, std::string& buffer) const;
+
+    MemoryReport get_memory_report() const;
+
+    /// Returns the line split into pieces, with nonprintable characters replaced.
+    Line get_line(int number);
 };
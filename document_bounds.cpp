@@ -0,0 +1,148 @@
+#include "document_bounds.hpp"
+#include "index_cache.hpp"
+#include <algorithm>
+#include <chrono>
+
+uint32_t calc_line_width(Line& line, sdl::Font& font)
+{
+    // count the sizes of all pieces on the line
+    uint32_t width = 0u;
+    for (auto& piece : line.pieces) {
+        width += font.calc_text_width(piece.get_text());
+    }
+
+    // add the spaces between pieces
+    return width + line.pieces.size() * font.get_space_width();
+}
+
+// how long the worker waits for more lines of a document being loaded
+static const auto LOADING_POLL_PERIOD = std::chrono::milliseconds(20);
+
+DocumentBounds::DocumentBounds(std::shared_ptr<Document> document, sdl::Font& font)
+    : m_document(document),
+      m_font(std::make_unique<sdl::Font>(font.get_path(), font.get_size()))
+{
+    m_worker = std::thread([this] { run(); });
+}
+
+DocumentBounds::~DocumentBounds()
+{
+    pause();
+}
+
+void DocumentBounds::pause()
+{
+    m_cancel_requested = true;
+    if (m_worker.joinable()) {
+        m_worker.join();
+    }
+    m_cancel_requested = false;
+}
+
+void DocumentBounds::resume(size_t keep_lines)
+{
+    pause();
+    {
+        std::lock_guard lock(m_mutex);
+        if (keep_lines < m_line_widths.size()) {
+            m_line_widths.resize(keep_lines);
+        }
+        if (keep_lines == 0) {
+            m_max_width = 0u;
+        }
+    }
+    m_worker = std::thread([this] { run(); });
+}
+
+size_t DocumentBounds::get_lines_done() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_line_widths.size();
+}
+
+uint32_t DocumentBounds::get_line_width(size_t number) const
+{
+    std::lock_guard lock(m_mutex);
+    return number < m_line_widths.size() ? m_line_widths[number] : 0u;
+}
+
+std::string DocumentBounds::get_cache_key() const
+{
+    return m_font->get_path() + ":" + std::to_string(m_font->get_size())
+        + (m_document->flag_coalesce_spaces ? ":coalesced" : "");
+}
+
+void DocumentBounds::load_cached_widths()
+{
+    std::string buffer;
+    auto bytes = m_document->read(0, m_document->get_byte_size(), buffer);
+    std::vector<uint32_t> widths;
+    if (IndexCache(m_document->get_path()).load_line_widths(bytes, get_cache_key(), widths)) {
+        m_max_width = widths.empty() ? 0u : *std::max_element(widths.begin(), widths.end());
+        std::lock_guard lock(m_mutex);
+        m_line_widths = std::move(widths);
+    }
+}
+
+void DocumentBounds::save_cached_widths()
+{
+    std::string buffer;
+    auto bytes = m_document->read(0, m_document->get_byte_size(), buffer);
+    std::lock_guard lock(m_mutex);
+    IndexCache(m_document->get_path()).save_line_widths(bytes, get_cache_key(), m_line_widths);
+}
+
+void DocumentBounds::run()
+{
+    // compressed files are not cached (reading them whole would defeat it);
+    // the widths are saved only when measured from the start, not each
+    // time the worker resumes with a few lines appended (in follow mode)
+    bool use_cache = m_document->flag_use_index_cache && !m_document->is_compressed();
+    bool measuring_all = use_cache && get_lines_done() == 0;
+    if (measuring_all) {
+        load_cached_widths();
+    }
+    size_t lines_measured = 0u;
+
+    uint32_t max_width = get_max_width();
+    std::vector<uint32_t> chunk_widths;
+    while (!m_cancel_requested) {
+
+        // (checked before the size, so that no lines are missed when the loading ends)
+        bool loading = m_document->is_loading();
+        size_t line_count = m_document->size();
+        size_t lines_done = get_lines_done();
+        if (lines_done >= line_count) {
+            if (!loading) {
+                if (measuring_all && lines_measured > 0) {
+                    save_cached_widths();
+                }
+                return;
+            }
+            std::this_thread::sleep_for(LOADING_POLL_PERIOD);
+            continue;
+        }
+
+        auto chunk_end = std::min(lines_done + CHUNK_SIZE, line_count);
+        chunk_widths.clear();
+        for (auto i = lines_done; i < chunk_end; i++) {
+
+            // empty lines need no measuring
+            uint32_t width = 0u;
+            if (m_document->get_line_length(i) != 0) {
+                auto line = m_document->get_line(i);
+                width = calc_line_width(line, *m_font);
+            }
+            chunk_widths.push_back(width);
+            max_width = std::max(max_width, width);
+        }
+
+        // publish the chunk
+        {
+            std::lock_guard lock(m_mutex);
+            m_line_widths.insert(m_line_widths.end(), chunk_widths.begin(), chunk_widths.end());
+        }
+        lines_measured += chunk_widths.size();
+        m_max_width.store(max_width, std::memory_order_release);
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "sdl_wrapper.hpp"
+#include "document.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Measures the width of the line in pixels, as it is laid out by View.
+uint32_t calc_line_width(Line& line, sdl::Font& font);
+
+/**
+ * Measures the widths of all lines of a document on a worker thread,
+ * in chunks, publishing the partial results as it goes. The widths are
+ * kept per line, so they are measured only once. If the document is
+ * still loading, the worker keeps up with it as it grows.
+ *
+ * The worker uses its own copy of the font, as TTF fonts must not be
+ * used from two threads at once.
+ *
+ * The widths of a big file are saved to an IndexCache once all are
+ * measured from the start (not after each resume()), so that they are
+ * not measured again next time.
+ */
+class DocumentBounds {
+protected:
+    std::shared_ptr<Document> m_document;
+    std::unique_ptr<sdl::Font> m_font;
+    mutable std::mutex m_mutex;                 ///< Guards m_line_widths.
+    std::vector<uint32_t> m_line_widths;        ///< Widths of the lines measured so far.
+    std::atomic<uint32_t> m_max_width = 0u;
+    std::atomic<bool> m_cancel_requested = false;
+    std::thread m_worker;
+
+    std::string get_cache_key() const;
+    void load_cached_widths();
+    void save_cached_widths();
+    void run();
+public:
+    const size_t CHUNK_SIZE = 4096u;    ///< Lines measured between publishing results.
+
+    DocumentBounds(std::shared_ptr<Document> document, sdl::Font& font);
+    DocumentBounds(DocumentBounds& other) = delete;
+    ~DocumentBounds();
+
+    /// Stops the worker (e.g. while the document changes).
+    void pause();
+
+    /// Forgets the widths of lines past `keep_lines` and restarts the worker
+    /// (with 0, the document is measured anew, e.g. after it was reopened).
+    void resume(size_t keep_lines);
+
+    /// Width of the widest line measured so far.
+    uint32_t get_max_width() const { return m_max_width.load(std::memory_order_acquire); }
+
+    /// Returns the number of lines measured so far (from the start).
+    size_t get_lines_done() const;
+
+    bool is_done() const { return !m_document->is_loading() && get_lines_done() >= m_document->size(); }
+
+    /// Returns the width of the line, or 0 if it has not been measured yet.
+    uint32_t get_line_width(size_t number) const;
+};
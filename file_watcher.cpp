@@ -0,0 +1,85 @@
+#include "file_watcher.hpp"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+
+FileWatcher::FileWatcher(std::string const& path)
+{
+    auto slash = path.rfind('/');
+    auto directory = (slash == std::string::npos) ? std::string(".") : path.substr(0, std::max<size_t>(slash, 1));
+    m_name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd < 0) {
+        throw std::runtime_error("inotify_init1() failed: " + std::string(strerror(errno)));
+    }
+    uint32_t mask = IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB;
+    m_watch = inotify_add_watch(m_fd, directory.c_str(), mask);
+    if (m_watch < 0) {
+        auto error = std::string(strerror(errno));
+        close(m_fd);
+        throw std::runtime_error("could not watch directory " + directory + ": " + error);
+    }
+    if (0 != pipe2(m_interrupt_pipe, O_CLOEXEC)) {
+        auto error = std::string(strerror(errno));
+        close(m_fd);
+        throw std::runtime_error("pipe2() failed: " + error);
+    }
+}
+
+FileWatcher::~FileWatcher()
+{
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+    for (auto fd : m_interrupt_pipe) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+bool FileWatcher::wait()
+{
+    pollfd fds[2] = { { m_fd, POLLIN, 0 }, { m_interrupt_pipe[0], POLLIN, 0 } };
+    for (;;) {
+        if (::poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        return !(fds[1].revents & POLLIN);
+    }
+}
+
+void FileWatcher::interrupt()
+{
+    char byte = 0;
+    while (write(m_interrupt_pipe[1], &byte, 1) < 0 && errno == EINTR) {
+    }
+}
+
+bool FileWatcher::poll()
+{
+    alignas(inotify_event) char buffer[4096];
+    bool changed = false;
+    for (;;) {
+        auto length = read(m_fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            break;
+        }
+        for (ssize_t pos = 0; pos < length; ) {
+            auto event = reinterpret_cast<inotify_event*>(buffer + pos);
+            if ((event->mask & IN_Q_OVERFLOW) || (event->len > 0 && m_name == event->name)) {
+                changed = true;
+            }
+            pos += sizeof(inotify_event) + event->len;
+        }
+    }
+    return changed;
+}
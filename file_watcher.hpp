@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+
+/**
+ * Watches a file for changes with inotify. The directory of the file is
+ * watched rather than the file itself, so that the watch survives the
+ * file being replaced (as in log rotation).
+ *
+ * A thread can block in wait() until there are notifications, and be
+ * woken up by interrupt() from another thread.
+ */
+class FileWatcher {
+protected:
+    int m_fd = -1;
+    int m_watch = -1;
+    int m_interrupt_pipe[2] = { -1, -1 };
+    std::string m_name;     ///< Name of the file within the watched directory.
+public:
+    explicit FileWatcher(std::string const& path);
+    FileWatcher(FileWatcher& other) = delete;
+    ~FileWatcher();
+
+    /// Reads all pending notifications (without blocking) and returns
+    /// true if any of them concerned the watched file.
+    bool poll();
+
+    /// Blocks until there are notifications to poll(). Returns false
+    /// if woken up by interrupt() instead (which lasts).
+    bool wait();
+
+    /// Wakes up wait() (for good, e.g. before destroying the watcher).
+    void interrupt();
+
+    /// The inotify descriptor, readable when there are notifications.
+    int get_fd() const { return m_fd; }
+};
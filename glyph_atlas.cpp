@@ -0,0 +1,128 @@
+#include "glyph_atlas.hpp"
+#include "utf8.hpp"
+#include "trace.hpp"
+
+// width and height of the atlas texture
+static const uint32_t ATLAS_SIZE = 1024u;
+
+// empty pixels kept around each glyph
+static const uint32_t GLYPH_PADDING = 1u;
+
+sdl::GlyphAtlas::GlyphAtlas(Renderer& renderer, std::shared_ptr<Font> font)
+    : m_font(font),
+      m_texture(renderer.make_texture(SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, Size2d(ATLAS_SIZE, ATLAS_SIZE)))
+{
+    if (0 != SDL_SetTextureBlendMode(m_texture, SDL_BLENDMODE_BLEND)) {
+        throw std::runtime_error("SDL_SetTextureBlendMode() failed: " + sdl::get_error());
+    }
+}
+
+sdl::GlyphAtlas::Entry& sdl::GlyphAtlas::get_entry(Renderer& renderer, uint32_t codepoint)
+{
+    auto key = std::make_pair(codepoint, m_font->get_size());
+    auto it = m_entries.find(key);
+    if (it != m_entries.end()) {
+        return it->second;
+    }
+    auto entry = make_entry(renderer, codepoint);
+    return m_entries.emplace(key, entry).first->second;
+}
+
+sdl::GlyphAtlas::Entry sdl::GlyphAtlas::make_entry(Renderer& renderer, uint32_t codepoint)
+{
+    Entry entry;
+    entry.advance = m_font->get_glyph_metrics(codepoint).advance;
+
+    // blank glyphs only move the pen (and TTF refuses to render some of them)
+    if (codepoint == ' ' || codepoint == '\t') {
+        return entry;
+    }
+
+    auto surface = m_font->render_glyph(codepoint, Color::WHITE).convert(SDL_PIXELFORMAT_ARGB8888);
+    place_glyph(renderer, codepoint, surface, entry);
+    return entry;
+}
+
+void sdl::GlyphAtlas::add_glyph(Renderer& renderer, uint32_t codepoint, uint32_t pt_size, Surface& surface, int32_t advance)
+{
+    // a glyph of a size since changed from is of no use
+    auto key = std::make_pair(codepoint, pt_size);
+    if (pt_size != m_font->get_size() || m_entries.contains(key)) {
+        return;
+    }
+    Entry entry;
+    entry.advance = advance;
+    place_glyph(renderer, codepoint, surface, entry);
+    m_entries.emplace(key, entry);
+}
+
+void sdl::GlyphAtlas::place_glyph(Renderer& renderer, uint32_t codepoint, Surface& surface, Entry& entry)
+{
+    auto size = surface.get_size();
+    if (size.w + GLYPH_PADDING > ATLAS_SIZE || size.h + GLYPH_PADDING > ATLAS_SIZE) {
+        throw std::runtime_error("glyph too big for the atlas: U+" + std::to_string(codepoint));
+    }
+
+    // start a new shelf if the glyph does not fit on the current one
+    if (m_shelf_x + size.w + GLYPH_PADDING > ATLAS_SIZE) {
+        m_shelf_x = 0;
+        m_shelf_y += m_shelf_height;
+        m_shelf_height = 0;
+    }
+
+    // if the atlas is full, draw what is queued and start over
+    if (m_shelf_y + size.h + GLYPH_PADDING > ATLAS_SIZE) {
+        flush(renderer);
+        m_entries.clear();
+        m_shelf_x = m_shelf_y = m_shelf_height = 0;
+    }
+
+    entry.source = Rect(m_shelf_x, m_shelf_y, size);
+    if (0 != SDL_UpdateTexture(m_texture, &entry.source, surface.peek()->pixels, surface.peek()->pitch)) {
+        throw std::runtime_error("SDL_UpdateTexture() failed: " + sdl::get_error());
+    }
+    m_shelf_x += size.w + GLYPH_PADDING;
+    m_shelf_height = std::max(m_shelf_height, size.h + GLYPH_PADDING);
+}
+
+void sdl::GlyphAtlas::add_quad(Rect target, Rect source, Color color)
+{
+    auto first = int(m_vertices.size());
+    auto vertex = [&](int x, int y, int u, int v) {
+        m_vertices.push_back(SDL_Vertex {
+            .position = SDL_FPoint { float(x), float(y) },
+            .color = color,
+            .tex_coord = SDL_FPoint { float(u) / ATLAS_SIZE, float(v) / ATLAS_SIZE }
+        });
+    };
+    vertex(target.x,            target.y,            source.x,            source.y);
+    vertex(target.x + target.w, target.y,            source.x + source.w, source.y);
+    vertex(target.x + target.w, target.y + target.h, source.x + source.w, source.y + source.h);
+    vertex(target.x,            target.y + target.h, source.x,            source.y + source.h);
+    for (int i : { 0, 1, 2, 0, 2, 3 }) {
+        m_indices.push_back(first + i);
+    }
+}
+
+uint32_t sdl::GlyphAtlas::add_text(Renderer& renderer, Point2d topleft, std::string_view text, Color color)
+{
+    int32_t x = topleft.x;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        auto codepoint = utf8::next_codepoint(text, pos);
+        auto& entry = get_entry(renderer, codepoint);
+        if (!entry.source.empty()) {
+            add_quad(Rect(x, topleft.y, entry.source.w, entry.source.h), entry.source, color);
+        }
+        x += entry.advance;
+    }
+    return x - topleft.x;
+}
+
+void sdl::GlyphAtlas::flush(Renderer& renderer)
+{
+    trace::Scope scope("GlyphAtlas::flush");
+    renderer.put_geometry(m_texture, m_vertices, m_indices);
+    m_vertices.clear();
+    m_indices.clear();
+}
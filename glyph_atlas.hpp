@@ -0,0 +1,69 @@
+#pragma once
+
+#include "sdl_wrapper.hpp"
+#include <map>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace sdl {
+
+/**
+ * Caches glyphs of a font in a single texture, each (codepoint, size)
+ * rasterized just once, and draws text as batches of textured quads.
+ * Text added by add_text() is queued and drawn all at once by flush(),
+ * in a single draw call. The glyphs are rasterized white and tinted
+ * by the vertex color, so one atlas serves any text color.
+ */
+class GlyphAtlas {
+public:
+    /// Where a glyph is placed in the atlas, and how far it moves the pen.
+    class Entry {
+    public:
+        Rect source;            ///< Glyph pixels in the atlas (empty for blank glyphs).
+        int32_t advance = 0;
+    };
+
+protected:
+    std::shared_ptr<Font> m_font;
+    Texture m_texture;
+
+    /// Glyphs already in the atlas, keyed by (codepoint, point size).
+    std::map<std::pair<uint32_t, uint32_t>, Entry> m_entries;
+
+    // shelf packing: glyphs are placed left to right in rows ("shelves")
+    uint32_t m_shelf_x = 0u;
+    uint32_t m_shelf_y = 0u;
+    uint32_t m_shelf_height = 0u;
+
+    // the queued quads
+    std::vector<SDL_Vertex> m_vertices;
+    std::vector<int> m_indices;
+
+    Entry& get_entry(Renderer& renderer, uint32_t codepoint);
+    Entry make_entry(Renderer& renderer, uint32_t codepoint);
+    void place_glyph(Renderer& renderer, uint32_t codepoint, Surface& surface, Entry& entry);
+    void add_quad(Rect target, Rect source, Color color);
+public:
+    GlyphAtlas(Renderer& renderer, std::shared_ptr<Font> font);
+    GlyphAtlas(GlyphAtlas& other) = delete;
+
+    std::shared_ptr<Font> get_font() { return m_font; }
+
+    /// Checks if the glyph (in the current size of the font) is in the atlas.
+    bool contains(uint32_t codepoint) const { return m_entries.contains(std::make_pair(codepoint, m_font->get_size())); }
+
+    /// Adds a glyph rasterized elsewhere (e.g. by another thread), in white
+    /// and ARGB8888 like those the atlas renders itself.
+    void add_glyph(Renderer& renderer, uint32_t codepoint, uint32_t pt_size, Surface& surface, int32_t advance);
+
+    /// Queues the text for drawing at the given position.
+    /// Returns the horizontal advance (width) of the text.
+    uint32_t add_text(Renderer& renderer, Point2d topleft, std::string_view text, Color color);
+
+    /// Draws all queued text in a single call.
+    void flush(Renderer& renderer);
+};
+
+} // namespace sdl
@@ -0,0 +1,413 @@
+#include "highlighter.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <array>
+#include <cctype>
+
+static bool is_word_char(char c)
+{
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+static bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+/// Returns the end of the word starting at `begin`.
+static size_t skip_word(std::string_view text, size_t begin)
+{
+    while (begin < text.size() && is_word_char(text[begin])) {
+        begin++;
+    }
+    return begin;
+}
+
+/// Returns the end of the number starting at `begin` (digits, with any
+/// letters, dots and signed exponents that belong to it).
+static size_t skip_number(std::string_view text, size_t begin)
+{
+    auto i = begin;
+    while (i < text.size()) {
+        auto c = text[i];
+        if (is_word_char(c) || c == '.') {
+            i++;
+        }
+        else if ((c == '+' || c == '-') && (text[i - 1] == 'e' || text[i - 1] == 'E')) {
+            i++;
+        }
+        else {
+            break;
+        }
+    }
+    return i;
+}
+
+/// Returns the end of the string quoted by text[begin] (past the closing
+/// quote, or the line end if it is not closed).
+static size_t skip_string(std::string_view text, size_t begin)
+{
+    auto quote = text[begin];
+    for (auto i = begin + 1; i < text.size(); i++) {
+        if (text[i] == '\\') {
+            i++;
+        }
+        else if (text[i] == quote) {
+            return i + 1;
+        }
+    }
+    return text.size();
+}
+
+static void add_run(std::vector<HighlightRun>& runs, size_t begin, size_t end, HighlightStyle style)
+{
+    if (end > begin) {
+        runs.push_back(HighlightRun { uint32_t(begin), uint32_t(end - begin), style });
+    }
+}
+
+// ---- LogHighlighter -------------------------------------------------------
+
+uint32_t LogHighlighter::highlight(std::string_view text, uint32_t state, std::vector<HighlightRun>& runs) const
+{
+    // a timestamp is a run of digits and separators at the line start
+    // (possibly in brackets), with enough digits to be a date or a time
+    size_t begin = (!text.empty() && text[0] == '[') ? 1 : 0;
+    size_t end = begin;
+    size_t digits = 0;
+    while (end < text.size() && (is_digit(text[end]) || std::string_view("-:./T,+Z ").find(text[end]) != std::string_view::npos)) {
+        digits += is_digit(text[end]) ? 1 : 0;
+        end++;
+    }
+    while (end > begin && text[end - 1] == ' ') {
+        end--;
+    }
+    if (digits >= 6) {
+        add_run(runs, begin, end, HighlightStyle::Timestamp);
+    }
+    else {
+        end = 0;
+    }
+
+    // the level words, in upper case
+    static const std::array<std::pair<std::string_view, HighlightStyle>, 11> LEVELS = {{
+        { "FATAL", HighlightStyle::Error }, { "CRITICAL", HighlightStyle::Error }, { "ERROR", HighlightStyle::Error },
+        { "ERR", HighlightStyle::Error }, { "WARNING", HighlightStyle::Warning }, { "WARN", HighlightStyle::Warning },
+        { "INFO", HighlightStyle::Info }, { "NOTICE", HighlightStyle::Info }, { "DEBUG", HighlightStyle::Debug },
+        { "TRACE", HighlightStyle::Debug }, { "VERBOSE", HighlightStyle::Debug },
+    }};
+    for (auto i = end; i < text.size(); ) {
+        if (!is_word_char(text[i])) {
+            i++;
+            continue;
+        }
+        auto word_end = skip_word(text, i);
+        auto word = text.substr(i, word_end - i);
+        if (word.size() >= 3 && std::isupper(static_cast<unsigned char>(word[0]))) {
+            for (auto& [level, style] : LEVELS) {
+                if (word == level) {
+                    add_run(runs, i, word_end, style);
+                    break;
+                }
+            }
+        }
+        i = word_end;
+    }
+    return state;
+}
+
+// ---- JsonHighlighter ------------------------------------------------------
+
+uint32_t JsonHighlighter::highlight(std::string_view text, uint32_t state, std::vector<HighlightRun>& runs) const
+{
+    for (size_t i = 0; i < text.size(); ) {
+        auto c = text[i];
+        if (c == '"') {
+
+            // a string followed by a colon is a key
+            auto end = skip_string(text, i);
+            auto next = end;
+            while (next < text.size() && (text[next] == ' ' || text[next] == '\t')) {
+                next++;
+            }
+            bool is_key = next < text.size() && text[next] == ':';
+            add_run(runs, i, end, is_key ? HighlightStyle::Key : HighlightStyle::String);
+            i = end;
+        }
+        else if (is_digit(c) || (c == '-' && i + 1 < text.size() && is_digit(text[i + 1]))) {
+            auto end = skip_number(text, i + 1);
+            add_run(runs, i, end, HighlightStyle::Number);
+            i = end;
+        }
+        else if (is_word_char(c)) {
+            auto end = skip_word(text, i);
+            auto word = text.substr(i, end - i);
+            if (word == "true" || word == "false" || word == "null") {
+                add_run(runs, i, end, HighlightStyle::Keyword);
+            }
+            i = end;
+        }
+        else {
+            i++;
+        }
+    }
+    return state;
+}
+
+// ---- CLikeHighlighter -----------------------------------------------------
+
+// the states carried over lines
+static const uint32_t IN_BLOCK_COMMENT = 1u;
+
+static bool is_keyword(std::string_view word)
+{
+    static const std::array<std::string_view, 60> KEYWORDS = {
+        "auto", "bool", "break", "case", "catch", "char", "class", "const", "constexpr", "continue",
+        "default", "delete", "do", "double", "else", "enum", "explicit", "extern", "false", "final",
+        "float", "for", "fn", "func", "function", "goto", "if", "import", "inline", "int",
+        "interface", "let", "long", "namespace", "new", "nullptr", "null", "override", "package", "private",
+        "protected", "public", "return", "short", "signed", "sizeof", "static", "struct", "switch", "template",
+        "this", "throw", "true", "try", "typedef", "unsigned", "using", "var", "virtual", "void",
+    };
+    return std::find(KEYWORDS.begin(), KEYWORDS.end(), word) != KEYWORDS.end();
+}
+
+uint32_t CLikeHighlighter::highlight(std::string_view text, uint32_t state, std::vector<HighlightRun>& runs) const
+{
+    size_t i = 0;
+
+    // a block comment open from the lines before
+    if (state == IN_BLOCK_COMMENT) {
+        auto end = text.find("*/");
+        if (end == std::string_view::npos) {
+            add_run(runs, 0, text.size(), HighlightStyle::Comment);
+            return IN_BLOCK_COMMENT;
+        }
+        add_run(runs, 0, end + 2, HighlightStyle::Comment);
+        i = end + 2;
+    }
+
+    // a preprocessor line
+    auto first = text.find_first_not_of(" \t");
+    if (i == 0 && first != std::string_view::npos && text[first] == '#') {
+        auto end = skip_word(text, first + 1);
+        add_run(runs, first, end, HighlightStyle::Keyword);
+        i = end;
+    }
+
+    while (i < text.size()) {
+        auto c = text[i];
+        if (c == '/' && i + 1 < text.size() && text[i + 1] == '/') {
+            add_run(runs, i, text.size(), HighlightStyle::Comment);
+            break;
+        }
+        if (c == '/' && i + 1 < text.size() && text[i + 1] == '*') {
+            auto end = text.find("*/", i + 2);
+            if (end == std::string_view::npos) {
+                add_run(runs, i, text.size(), HighlightStyle::Comment);
+                return IN_BLOCK_COMMENT;
+            }
+            add_run(runs, i, end + 2, HighlightStyle::Comment);
+            i = end + 2;
+        }
+        else if (c == '"' || c == '\'') {
+            auto end = skip_string(text, i);
+            add_run(runs, i, end, HighlightStyle::String);
+            i = end;
+        }
+        else if (is_digit(c)) {
+            auto end = skip_number(text, i + 1);
+            add_run(runs, i, end, HighlightStyle::Number);
+            i = end;
+        }
+        else if (is_word_char(c)) {
+            auto end = skip_word(text, i);
+            if (is_keyword(text.substr(i, end - i))) {
+                add_run(runs, i, end, HighlightStyle::Keyword);
+            }
+            i = end;
+        }
+        else {
+            i++;
+        }
+    }
+    return Highlighter::INITIAL_STATE;
+}
+
+std::unique_ptr<Highlighter> make_highlighter(std::string const& path)
+{
+    // the extension, past a compression suffix
+    auto name = path;
+    if (name.size() > 3 && name.ends_with(".gz")) {
+        name.resize(name.size() - 3);
+    }
+    auto dot = name.rfind('.');
+    auto extension = (dot == std::string::npos) ? std::string() : name.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+
+    if (extension == "json" || extension == "jsonl" || extension == "ndjson") {
+        return std::make_unique<JsonHighlighter>();
+    }
+    static const std::array<std::string_view, 16> C_LIKE = {
+        "c", "h", "cc", "cpp", "cxx", "hpp", "hh", "hxx", "java", "js", "ts", "cs", "go", "rs", "swift", "kt",
+    };
+    if (std::find(C_LIKE.begin(), C_LIKE.end(), extension) != C_LIKE.end()) {
+        return std::make_unique<CLikeHighlighter>();
+    }
+    return std::make_unique<LogHighlighter>();
+}
+
+// ---- HighlightCache -------------------------------------------------------
+
+HighlightCache::HighlightCache(std::shared_ptr<Document> document, std::unique_ptr<Highlighter> highlighter)
+    : m_document(document), m_highlighter(std::move(highlighter)), m_checkpoints(1, Highlighter::INITIAL_STATE)
+{
+}
+
+HighlightCache::Entry const& HighlightCache::highlight_line(size_t number, uint32_t state, bool provisional)
+{
+    if (m_lines.size() >= MAX_CACHED_LINES) {
+        m_lines.clear();
+    }
+    auto line = m_document->get_line(number);
+    auto text = line.get_text().substr(0, MAX_HIGHLIGHTED_LENGTH);
+    Entry entry;
+    entry.end_state = m_highlighter->highlight(text, state, entry.runs);
+    entry.provisional = provisional;
+
+    // a line ending at a checkpoint records it (unless its state was assumed)
+    if ((number + 1) % CHECKPOINT_INTERVAL == 0 && !provisional) {
+        auto checkpoint = (number + 1) / CHECKPOINT_INTERVAL;
+        if (checkpoint >= m_checkpoints.size()) {
+            m_checkpoints.resize(checkpoint + 1, UNKNOWN_STATE);
+        }
+        m_checkpoints[checkpoint] = entry.end_state;
+    }
+    return m_lines[number] = std::move(entry);
+}
+
+uint32_t HighlightCache::get_start_state(size_t number, bool& provisional)
+{
+    provisional = false;
+    if (!m_highlighter->is_stateful() || number == 0) {
+        return Highlighter::INITIAL_STATE;
+    }
+
+    // the line before may be cached...
+    auto previous = m_lines.find(number - 1);
+    if (previous != m_lines.end()) {
+        provisional = previous->second.provisional;
+        return previous->second.end_state;
+    }
+
+    // ...or else the lines from the nearest checkpoint are highlighted
+    // (and cached); a checkpoint too far behind is not worth the scan, the
+    // initial state is assumed at the one before the line instead (until
+    // fill_checkpoints() gets there)
+    auto checkpoint = number / CHECKPOINT_INTERVAL;
+    size_t known = std::min(checkpoint, m_checkpoints.size() - 1);
+    while (known > 0 && m_checkpoints[known] == UNKNOWN_STATE) {
+        known--;
+    }
+    uint32_t state = m_checkpoints[known];
+    if (checkpoint - known > MAX_CHECKPOINT_GAP) {
+        known = checkpoint;
+        state = Highlighter::INITIAL_STATE;
+        provisional = true;
+        m_fill_target = std::max(m_fill_target, checkpoint);
+    }
+    for (auto i = known * CHECKPOINT_INTERVAL; i < number; i++) {
+        auto cached = m_lines.find(i);
+        if (cached != m_lines.end() && (provisional || !cached->second.provisional)) {
+            state = cached->second.end_state;
+            provisional = cached->second.provisional;
+        }
+        else {
+            state = highlight_line(i, state, provisional).end_state;
+        }
+    }
+    return state;
+}
+
+std::vector<HighlightRun> const& HighlightCache::get_runs(size_t number)
+{
+    auto it = m_lines.find(number);
+    if (it != m_lines.end()) {
+        return it->second.runs;
+    }
+    bool provisional;
+    auto state = get_start_state(number, provisional);
+    return highlight_line(number, state, provisional).runs;
+}
+
+void HighlightCache::fill_checkpoints(std::chrono::steady_clock::time_point deadline)
+{
+    if (m_fill_target == 0) {
+        return;
+    }
+    trace::Scope scope("HighlightCache::fill_checkpoints");
+
+    // each checkpoint from the one before it, with the runs thrown away
+    // (the lines are not cached, so that the lines in view stay cached;
+    // they all exist, as lines past them were highlighted); the deadline
+    // is checked on every line, as a line can take long
+    std::vector<HighlightRun> runs;
+    while (m_checkpoints_filled <= m_fill_target) {
+        auto checkpoint = m_checkpoints_filled;
+        if (checkpoint < m_checkpoints.size() && m_checkpoints[checkpoint] != UNKNOWN_STATE) {
+            m_checkpoints_filled++;
+            continue;
+        }
+        auto first = (checkpoint - 1) * CHECKPOINT_INTERVAL;
+        if (m_fill_line <= first) {
+            m_fill_line = first;
+            m_fill_state = m_checkpoints[checkpoint - 1];
+        }
+        for (; m_fill_line < checkpoint * CHECKPOINT_INTERVAL; m_fill_line++) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                return;
+            }
+            auto cached = m_lines.find(m_fill_line);
+            if (cached != m_lines.end() && !cached->second.provisional) {
+                m_fill_state = cached->second.end_state;
+                continue;
+            }
+            auto line = m_document->get_line(m_fill_line);
+            runs.clear();
+            m_fill_state = m_highlighter->highlight(line.get_text().substr(0, MAX_HIGHLIGHTED_LENGTH), m_fill_state, runs);
+        }
+        if (checkpoint >= m_checkpoints.size()) {
+            m_checkpoints.resize(checkpoint + 1, UNKNOWN_STATE);
+        }
+        m_checkpoints[checkpoint] = m_fill_state;
+        m_checkpoints_filled++;
+    }
+
+    // with the checkpoints known, the provisional runs are done again
+    if (m_checkpoints_filled > m_fill_target) {
+        std::erase_if(m_lines, [](auto const& line) { return line.second.provisional; });
+        m_fill_target = 0;
+        m_generation++;
+    }
+}
+
+void HighlightCache::invalidate_from(size_t number)
+{
+    std::erase_if(m_lines, [&](auto const& line) { return line.first >= number; });
+
+    // (checkpoint c is the state at the start of line c * CHECKPOINT_INTERVAL,
+    // which depends on the lines before it only)
+    m_checkpoints.resize(std::min(m_checkpoints.size(), number / CHECKPOINT_INTERVAL + 1));
+    m_checkpoints_filled = std::min(m_checkpoints_filled, m_checkpoints.size());
+    m_fill_line = 0u;
+}
+
+void HighlightCache::clear()
+{
+    m_lines.clear();
+    m_checkpoints.assign(1, Highlighter::INITIAL_STATE);
+    m_checkpoints_filled = 1u;
+    m_fill_target = 0u;
+    m_fill_line = 0u;
+    m_generation++;
+}
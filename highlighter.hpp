@@ -0,0 +1,145 @@
+#pragma once
+
+#include "document.hpp"
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/// What a run of text is, for coloring it.
+enum class HighlightStyle : uint8_t {
+    Normal,
+    Timestamp,
+    Error,
+    Warning,
+    Info,
+    Debug,
+    Key,
+    String,
+    Number,
+    Keyword,
+    Comment
+};
+
+/// A run of text of a line in one style (the text between runs is Normal).
+class HighlightRun {
+public:
+    uint32_t offset;    ///< Byte offset from the line start.
+    uint32_t length;
+    HighlightStyle style;
+};
+
+/**
+ * Splits a line into styled runs. The tokenizer state at the line start
+ * (e.g. "inside a block comment") comes from the previous line, and the
+ * state at the line end is returned for the next one; a highlighter
+ * whose state never carries over says so with is_stateful().
+ */
+class Highlighter {
+public:
+    static constexpr uint32_t INITIAL_STATE = 0u;
+
+    virtual ~Highlighter() {}
+
+    /// Appends the (not Normal) runs of the line, in order, and returns
+    /// the state at its end.
+    virtual uint32_t highlight(std::string_view text, uint32_t state, std::vector<HighlightRun>& runs) const = 0;
+    virtual bool is_stateful() const { return false; }
+};
+
+/// Log files: the timestamp at the line start, and the log level words.
+class LogHighlighter : public Highlighter {
+public:
+    uint32_t highlight(std::string_view text, uint32_t state, std::vector<HighlightRun>& runs) const override;
+};
+
+/// JSON (also one document per line): keys, strings, numbers, literals.
+class JsonHighlighter : public Highlighter {
+public:
+    uint32_t highlight(std::string_view text, uint32_t state, std::vector<HighlightRun>& runs) const override;
+};
+
+/// C and the languages that look like it: keywords, strings, numbers,
+/// line and block comments (which carry over lines), preprocessor lines.
+class CLikeHighlighter : public Highlighter {
+public:
+    uint32_t highlight(std::string_view text, uint32_t state, std::vector<HighlightRun>& runs) const override;
+    bool is_stateful() const override { return true; }
+};
+
+/// Picks the highlighter by the file name (a log highlighter by default).
+std::unique_ptr<Highlighter> make_highlighter(std::string const& path);
+
+/**
+ * The runs of the lines of a document, computed as the lines are drawn.
+ *
+ * The state at the start of every CHECKPOINT_INTERVAL-th line is kept,
+ * so the state of a line is found by highlighting at most that many lines
+ * before it (which are then cached, so scrolling on costs one line per
+ * line). A line far past the checkpoints known is started from the initial
+ * state at the checkpoint before it, rather than from the top of the file,
+ * and its runs are provisional (e.g. a block comment open across the jump
+ * is missed): fill_checkpoints(), called when idle, then works out the
+ * checkpoints up to there, a few lines at a time (as many as fit in the
+ * time it is given), and drops the provisional runs once they are known,
+ * so that the lines are highlighted again.
+ *
+ * The lines are cached with their runs, up to MAX_CACHED_LINES at once.
+ * Only the first MAX_HIGHLIGHTED_LENGTH bytes of a line are highlighted.
+ */
+class HighlightCache {
+public:
+    /// The runs of a line, and the state at its end.
+    class Entry {
+    public:
+        std::vector<HighlightRun> runs;
+        uint32_t end_state = Highlighter::INITIAL_STATE;
+        bool provisional = false;   ///< Started from an assumed state.
+    };
+
+protected:
+    std::shared_ptr<Document> m_document;
+    std::unique_ptr<Highlighter> m_highlighter;
+    std::unordered_map<size_t, Entry> m_lines;
+    std::vector<uint32_t> m_checkpoints;        ///< [c] = state at the start of line c * CHECKPOINT_INTERVAL.
+    size_t m_checkpoints_filled = 1u;           ///< Checkpoints known from the first one on, without a gap.
+    size_t m_fill_target = 0u;                  ///< Checkpoint assumed by the provisional runs (0 if none).
+    size_t m_fill_line = 0u;                    ///< Next line to fill checkpoint m_checkpoints_filled from...
+    uint32_t m_fill_state = Highlighter::INITIAL_STATE;    ///< ...and the state at its start.
+    uint64_t m_generation = 0u;
+
+    uint32_t get_start_state(size_t number, bool& provisional);
+    Entry const& highlight_line(size_t number, uint32_t state, bool provisional);
+public:
+    static constexpr size_t CHECKPOINT_INTERVAL = 256u;
+    static constexpr size_t MAX_CHECKPOINT_GAP = 16u;      ///< Checkpoints scanned through at most, to reach a line.
+    static constexpr size_t MAX_CACHED_LINES = 8192u;
+    static constexpr size_t MAX_HIGHLIGHTED_LENGTH = 1u << 20;
+    static constexpr uint32_t UNKNOWN_STATE = UINT32_MAX;
+
+    HighlightCache(std::shared_ptr<Document> document, std::unique_ptr<Highlighter> highlighter);
+    HighlightCache(HighlightCache& other) = delete;
+
+    /// Returns the runs of the line (highlighting it, and the lines
+    /// before it since the last checkpoint, if needed).
+    std::vector<HighlightRun> const& get_runs(size_t number);
+
+    /// Checks if there are provisional runs, i.e. fill_checkpoints() has work to do.
+    bool is_filling() const { return m_fill_target > 0; }
+
+    /// Works out the checkpoints up to those the provisional runs assumed,
+    /// until the deadline (going on from there the next time); once there,
+    /// drops the provisional runs.
+    void fill_checkpoints(std::chrono::steady_clock::time_point deadline);
+
+    /// Changes whenever cached runs are dropped for better ones (so the
+    /// lines drawn with them are to be drawn again).
+    uint64_t get_generation() const { return m_generation; }
+
+    /// Forgets the lines from `number` on (e.g. the last line that grew).
+    void invalidate_from(size_t number);
+    void clear();
+};
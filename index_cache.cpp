@@ -0,0 +1,261 @@
+#include "index_cache.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char CACHE_MAGIC[8] = { 'V', 'W', 'R', 'I', 'D', 'X', '1', '\0' };
+
+/// The start of a cache file; the entries follow.
+class CacheHeader {
+public:
+    char magic[8];
+    uint32_t entry_size;
+    uint32_t reserved;
+    uint64_t covered;       ///< Bytes of the file covered by the entries.
+    int64_t mtime_ns;       ///< Modification time of the file when saved.
+    uint64_t head_hash;
+    uint64_t tail_hash;
+    uint64_t key_hash;
+    uint64_t count;         ///< Number of entries.
+};
+
+// FNV-1a; only used to tell files apart, not for security
+static uint64_t hash_bytes(std::string_view bytes)
+{
+    uint64_t hash = 0xcbf29ce484222325u;
+    for (unsigned char c : bytes) {
+        hash = (hash ^ c) * 0x100000001b3u;
+    }
+    return hash;
+}
+
+static uint64_t hash_head(std::string_view bytes, uint64_t covered)
+{
+    return hash_bytes(bytes.substr(0, std::min<uint64_t>(covered, IndexCache::HASHED_SIZE)));
+}
+
+static uint64_t hash_tail(std::string_view bytes, uint64_t covered)
+{
+    auto size = std::min<uint64_t>(covered, IndexCache::HASHED_SIZE);
+    return hash_bytes(bytes.substr(covered - size, size));
+}
+
+static int64_t get_modification_time(std::string const& path)
+{
+    struct stat st;
+    if (0 != stat(path.c_str(), &st)) {
+        return -1;
+    }
+    return int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+IndexCache::IndexCache(std::string const& file_path)
+    : m_file_path(file_path)
+{
+    // a small file is never cached, so there is nothing to look up
+    struct stat st;
+    if (0 != stat(file_path.c_str(), &st) || uint64_t(st.st_size) < MIN_FILE_SIZE) {
+        return;
+    }
+
+    std::string directory;
+    if (auto xdg = getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+        directory = xdg;
+    }
+    else if (auto home = getenv("HOME"); home && *home) {
+        directory = std::string(home) + "/.cache";
+    }
+    else {
+        return;
+    }
+    mkdir(directory.c_str(), 0700);
+    directory += "/viewer";
+    mkdir(directory.c_str(), 0700);
+
+    // the same file may be opened by different relative paths
+    char absolute[PATH_MAX];
+    std::string path = realpath(file_path.c_str(), absolute) ? absolute : file_path;
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash_bytes(path));
+    m_cache_directory = directory;
+    m_cache_path = directory + "/" + name;
+}
+
+bool IndexCache::load(std::string const& kind, std::string_view bytes, std::string const& key,
+    uint32_t entry_size, MappedFile& cache, uint64_t& covered, std::string_view& entries) const
+{
+    if (m_cache_path.empty() || bytes.size() < MIN_FILE_SIZE) {
+        return false;
+    }
+    try {
+        cache = MappedFile(m_cache_path + "." + kind);
+    }
+    catch (std::runtime_error& e) {
+        return false;
+    }
+
+    CacheHeader header;
+    auto data = cache.get_bytes();
+    if (data.size() < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    if (0 != memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) || header.entry_size != entry_size
+        || header.key_hash != hash_bytes(key) || header.count != (data.size() - sizeof(header)) / entry_size
+        || header.covered > bytes.size()) {
+        return false;
+    }
+
+    // an unchanged file must have the same time; a grown one has a new
+    // time, but the same bytes where it used to end
+    if (header.covered == bytes.size() && header.mtime_ns != get_modification_time(m_file_path)) {
+        return false;
+    }
+    if (header.head_hash != hash_head(bytes, header.covered) || header.tail_hash != hash_tail(bytes, header.covered)) {
+        return false;
+    }
+
+    // (the time of use decides which cache files are removed first)
+    utimensat(AT_FDCWD, (m_cache_path + "." + kind).c_str(), nullptr, 0);
+    covered = header.covered;
+    entries = data.substr(sizeof(header), header.count * entry_size);
+    return true;
+}
+
+void IndexCache::save(std::string const& kind, std::string_view bytes, std::string const& key,
+    uint32_t entry_size, uint64_t count, std::function<bool(FILE*)> const& write_entries) const
+{
+    if (m_cache_path.empty() || bytes.size() < MIN_FILE_SIZE) {
+        return;
+    }
+
+    CacheHeader header {};
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.entry_size = entry_size;
+    header.covered = bytes.size();
+    header.mtime_ns = get_modification_time(m_file_path);
+    header.head_hash = hash_head(bytes, bytes.size());
+    header.tail_hash = hash_tail(bytes, bytes.size());
+    header.key_hash = hash_bytes(key);
+    header.count = count;
+
+    // written aside and renamed, so that a reader never sees a partial file
+    auto path = m_cache_path + "." + kind;
+    auto temporary_path = path + ".tmp" + std::to_string(getpid());
+    FILE* file = fopen(temporary_path.c_str(), "wb");
+    if (!file) {
+        return;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 && write_entries(file);
+    written = (0 == fclose(file)) && written;
+    if (!written || 0 != rename(temporary_path.c_str(), path.c_str())) {
+        unlink(temporary_path.c_str());
+        return;
+    }
+    remove_old();
+}
+
+void IndexCache::remove_old() const
+{
+    class CacheFile {
+    public:
+        std::string path;
+        uint64_t size;
+        int64_t mtime_ns;
+    };
+    std::vector<CacheFile> files;
+    uint64_t total_size = 0u;
+    DIR* directory = opendir(m_cache_directory.c_str());
+    if (!directory) {
+        return;
+    }
+    while (auto entry = readdir(directory)) {
+        auto path = m_cache_directory + "/" + entry->d_name;
+        struct stat st;
+        if (0 == stat(path.c_str(), &st) && S_ISREG(st.st_mode)) {
+            files.push_back(CacheFile { path, uint64_t(st.st_size), int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec });
+            total_size += st.st_size;
+        }
+    }
+    closedir(directory);
+
+    // the least recently used first (those of this file are kept)
+    std::sort(files.begin(), files.end(), [](CacheFile const& a, CacheFile const& b) { return a.mtime_ns < b.mtime_ns; });
+    for (auto& file : files) {
+        if (total_size <= MAX_CACHE_SIZE) {
+            break;
+        }
+        if (file.path.starts_with(m_cache_path + ".")) {
+            continue;
+        }
+        if (0 == unlink(file.path.c_str())) {
+            total_size -= file.size;
+        }
+    }
+}
+
+uint64_t IndexCache::load_line_starts(std::string_view bytes, LineOffsets& line_starts) const
+{
+    MappedFile cache;
+    uint64_t covered = 0u;
+    std::string_view entries;
+    if (!load("lines", bytes, "", sizeof(uint64_t), cache, covered, entries) || entries.empty()) {
+        return 0u;
+    }
+    line_starts.clear();
+    line_starts.reserve(entries.size() / sizeof(uint64_t));
+    for (size_t i = 0; i < entries.size(); i += sizeof(uint64_t)) {
+        uint64_t offset;
+        memcpy(&offset, entries.data() + i, sizeof(offset));
+        line_starts.push_back(offset);
+    }
+    return covered;
+}
+
+void IndexCache::save_line_starts(std::string_view bytes, LineOffsets const& line_starts) const
+{
+    // the entries are full 64-bit offsets, written a buffer at a time
+    save("lines", bytes, "", sizeof(uint64_t), line_starts.size(), [&](FILE* file) {
+        std::vector<uint64_t> buffer;
+        for (size_t i = 0; i < line_starts.size(); ) {
+            buffer.clear();
+            for (; i < line_starts.size() && buffer.size() < (1u << 16); i++) {
+                buffer.push_back(line_starts[i]);
+            }
+            if (fwrite(buffer.data(), sizeof(uint64_t), buffer.size(), file) != buffer.size()) {
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+bool IndexCache::load_line_widths(std::string_view bytes, std::string const& key, std::vector<uint32_t>& widths) const
+{
+    MappedFile cache;
+    uint64_t covered = 0u;
+    std::string_view entries;
+    if (!load("widths", bytes, key, sizeof(uint32_t), cache, covered, entries)) {
+        return false;
+    }
+    widths.resize(entries.size() / sizeof(uint32_t));
+    memcpy(widths.data(), entries.data(), entries.size());
+    if (covered < bytes.size() && !widths.empty()) {
+        widths.pop_back();
+    }
+    return true;
+}
+
+void IndexCache::save_line_widths(std::string_view bytes, std::string const& key, std::vector<uint32_t> const& widths) const
+{
+    save("widths", bytes, key, sizeof(uint32_t), widths.size(), [&](FILE* file) {
+        return fwrite(widths.data(), sizeof(uint32_t), widths.size(), file) == widths.size();
+    });
+}
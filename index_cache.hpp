@@ -0,0 +1,62 @@
+#pragma once
+
+#include "document.hpp"
+#include "line_index.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * A sidecar cache of per-line data of a file (the line starts, the line
+ * widths), so that reopening a big file does not scan it all again.
+ *
+ * The cache files live in $XDG_CACHE_HOME/viewer (or ~/.cache/viewer),
+ * named after a hash of the absolute path of the file. An entry records
+ * how many bytes of the file it covers, the modification time and
+ * a hash of the first and the last bytes covered. It is valid if the
+ * file is unchanged, or if it only grew (then the entry covers its start,
+ * and only the tail needs to be scanned). A `key` tells apart the entries
+ * that depend on more than the file, e.g. the widths on the font.
+ *
+ * The cache files of all the files opened share MAX_CACHE_SIZE; past it,
+ * the least recently used are removed when another one is saved.
+ *
+ * All failures are silent: a missing or invalid cache just means
+ * the data are computed again.
+ */
+class IndexCache {
+protected:
+    std::string m_file_path;
+    std::string m_cache_directory;
+    std::string m_cache_path;   ///< Without the extension; empty if the file is not cached.
+
+    /// Maps the cache file and returns its entries if it is valid for the bytes.
+    bool load(std::string const& kind, std::string_view bytes, std::string const& key,
+        uint32_t entry_size, MappedFile& cache, uint64_t& covered, std::string_view& entries) const;
+    /// Writes a cache file of `count` entries, written out by `write_entries`.
+    void save(std::string const& kind, std::string_view bytes, std::string const& key,
+        uint32_t entry_size, uint64_t count, std::function<bool(FILE*)> const& write_entries) const;
+    /// Removes the least recently used cache files past MAX_CACHE_SIZE.
+    void remove_old() const;
+public:
+    static constexpr uint64_t MIN_FILE_SIZE = 16u << 20;   ///< Smaller files are scanned faster than looked up.
+    static constexpr size_t HASHED_SIZE = 64u << 10;        ///< How much of the head and the tail is hashed.
+    static constexpr uint64_t MAX_CACHE_SIZE = 1ull << 30;  ///< Of all the cache files together.
+
+    explicit IndexCache(std::string const& file_path);
+
+    /// Replaces the line starts with the cached ones if they are valid for
+    /// the bytes (the current contents of the file). Returns the number of
+    /// bytes they cover, or 0 if there are none.
+    uint64_t load_line_starts(std::string_view bytes, LineOffsets& line_starts) const;
+    void save_line_starts(std::string_view bytes, LineOffsets const& line_starts) const;
+
+    /// Like load_line_starts(), for the widths measured with the font
+    /// (and settings) described by the key. If the file grew, the width
+    /// of the last line (which may have been partial) is left out.
+    bool load_line_widths(std::string_view bytes, std::string const& key, std::vector<uint32_t>& widths) const;
+    void save_line_widths(std::string_view bytes, std::string const& key, std::vector<uint32_t> const& widths) const;
+};
@@ -0,0 +1,72 @@
+#include "line_cache.hpp"
+
+sdl::Texture* LineTextureCache::find(Key const& key)
+{
+    auto it = m_index.find(key);
+    if (it == m_index.end()) {
+        m_misses++;
+        return nullptr;
+    }
+    m_hits++;
+
+    // move to the front (most recently used)
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    return &it->second->texture;
+}
+
+sdl::Texture& LineTextureCache::insert(Key const& key, sdl::Texture&& texture)
+{
+    auto size = texture.get_size();
+    size_t bytes = size_t(size.w) * size.h * 4;
+
+    // replace an older version, if any
+    auto it = m_index.find(key);
+    if (it != m_index.end()) {
+        m_used_bytes -= it->second->bytes;
+        m_entries.erase(it->second);
+        m_index.erase(it);
+    }
+
+    evict_to(bytes <= m_budget ? m_budget - bytes : 0);
+    m_entries.push_front(Entry { key, std::move(texture), bytes });
+    m_index.emplace(key, m_entries.begin());
+    m_used_bytes += bytes;
+    return m_entries.front().texture;
+}
+
+void LineTextureCache::evict_to(size_t bytes)
+{
+    while (m_used_bytes > bytes && !m_entries.empty()) {
+        auto& victim = m_entries.back();
+        m_used_bytes -= victim.bytes;
+        m_index.erase(victim.key);
+        m_entries.pop_back();
+    }
+}
+
+void LineTextureCache::invalidate_line(uint32_t line)
+{
+    for (auto it = m_entries.begin(); it != m_entries.end(); ) {
+        if (it->key.line == line) {
+            m_used_bytes -= it->bytes;
+            m_index.erase(it->key);
+            it = m_entries.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+void LineTextureCache::clear()
+{
+    m_index.clear();
+    m_entries.clear();
+    m_used_bytes = 0u;
+}
+
+void LineTextureCache::set_budget(size_t budget)
+{
+    m_budget = budget;
+    evict_to(m_budget);
+}
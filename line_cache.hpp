@@ -0,0 +1,78 @@
+#pragma once
+
+#include "sdl_wrapper.hpp"
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+
+/**
+ * A bounded cache of rendered line textures, with least-recently-used
+ * eviction. The memory budget is counted in texture pixels (4 bytes each).
+ */
+class LineTextureCache {
+public:
+    /// Identifies a rendered line: which line, in which font and color.
+    class Key {
+    public:
+        uint32_t line = 0u;
+        sdl::Font* font = nullptr;
+        uint32_t font_size = 0u;
+        uint32_t color = 0u;    ///< RGBA packed into one number.
+
+        Key(uint32_t line_, sdl::Font& font_, sdl::Color color_)
+            : line(line_), font(&font_), font_size(font_.get_size()),
+              color((color_.r << 24) | (color_.g << 16) | (color_.b << 8) | color_.a) {}
+        bool operator==(Key const& other) const = default;
+    };
+
+protected:
+    class KeyHash {
+    public:
+        size_t operator()(Key const& key) const {
+            size_t h = std::hash<uint32_t>()(key.line);
+            h = h * 31 + std::hash<sdl::Font*>()(key.font);
+            h = h * 31 + key.font_size;
+            return h * 31 + key.color;
+        }
+    };
+
+    class Entry {
+    public:
+        Key key;
+        sdl::Texture texture;
+        size_t bytes;
+    };
+
+    std::list<Entry> m_entries;     ///< The most recently used go first.
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_index;
+    size_t m_budget;
+    size_t m_used_bytes = 0u;
+    uint64_t m_hits = 0u;
+    uint64_t m_misses = 0u;
+
+    void evict_to(size_t bytes);
+public:
+    explicit LineTextureCache(size_t budget) : m_budget(budget) {}
+    LineTextureCache(LineTextureCache& other) = delete;
+
+    /// Returns the cached texture, or nullptr if there is none.
+    sdl::Texture* find(Key const& key);
+
+    /// Checks if the texture is cached (without counting it as used).
+    bool contains(Key const& key) const { return m_index.contains(key); }
+
+    /// Stores the texture, evicting the least recently used ones if over budget.
+    sdl::Texture& insert(Key const& key, sdl::Texture&& texture);
+
+    /// Drops all cached textures of the given line.
+    void invalidate_line(uint32_t line);
+
+    /// Drops all cached textures (the counters are kept).
+    void clear();
+
+    void set_budget(size_t budget);
+    size_t get_budget() const { return m_budget; }
+    size_t get_used_bytes() const { return m_used_bytes; }
+    uint64_t get_hits() const { return m_hits; }
+    uint64_t get_misses() const { return m_misses; }
+};
@@ -0,0 +1,185 @@
+#include "line_index.hpp"
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+// chunks smaller than this are not worth a thread of their own
+static const size_t MIN_CHUNK_SIZE = 4u << 20;
+
+static void find_line_starts_scalar(char const* data, size_t begin, size_t end, uint64_t base,
+    std::vector<uint64_t>& line_starts)
+{
+    while (begin < end) {
+        auto eol = static_cast<char const*>(memchr(data + begin, '\n', end - begin));
+        if (!eol) {
+            break;
+        }
+        begin = (eol - data) + 1;
+        line_starts.push_back(base + begin);
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+/// Appends the line starts for each bit set in the mask of line feeds found at `offset`.
+static inline void push_mask_bits(uint32_t mask, size_t offset, uint64_t base, std::vector<uint64_t>& line_starts)
+{
+    while (mask) {
+        line_starts.push_back(base + offset + __builtin_ctz(mask) + 1);
+        mask &= mask - 1;
+    }
+}
+
+__attribute__((target("sse2")))
+static size_t find_line_starts_sse2(char const* data, size_t begin, size_t end, uint64_t base,
+    std::vector<uint64_t>& line_starts)
+{
+    auto newlines = _mm_set1_epi8('\n');
+    for (; begin + 16 <= end; begin += 16) {
+        auto block = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + begin));
+        uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newlines));
+        push_mask_bits(mask, begin, base, line_starts);
+    }
+    return begin;
+}
+
+__attribute__((target("avx2")))
+static size_t find_line_starts_avx2(char const* data, size_t begin, size_t end, uint64_t base,
+    std::vector<uint64_t>& line_starts)
+{
+    auto newlines = _mm256_set1_epi8('\n');
+    for (; begin + 32 <= end; begin += 32) {
+        auto block = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(data + begin));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newlines));
+        push_mask_bits(mask, begin, base, line_starts);
+    }
+    return begin;
+}
+
+static bool has_avx2()
+{
+    static bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+#endif
+
+void find_line_starts(std::string_view bytes, uint64_t base, std::vector<uint64_t>& line_starts)
+{
+    size_t position = 0;
+#ifdef HAVE_X86_SIMD
+    if (has_avx2()) {
+        position = find_line_starts_avx2(bytes.data(), position, bytes.size(), base, line_starts);
+    }
+    position = find_line_starts_sse2(bytes.data(), position, bytes.size(), base, line_starts);
+#endif
+    // the tail (or everything, without SIMD)
+    find_line_starts_scalar(bytes.data(), position, bytes.size(), base, line_starts);
+}
+
+void find_line_starts_parallel(std::string_view bytes, uint64_t base, std::vector<uint64_t>& line_starts,
+    unsigned thread_count)
+{
+    if (thread_count == 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    size_t chunk_count = std::min<size_t>(thread_count, bytes.size() / MIN_CHUNK_SIZE);
+    if (chunk_count <= 1) {
+        find_line_starts(bytes, base, line_starts);
+        return;
+    }
+
+    // each chunk is scanned into its own vector...
+    size_t chunk_size = bytes.size() / chunk_count;
+    std::vector<std::vector<uint64_t>> chunk_results(chunk_count);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < chunk_count; i++) {
+        size_t begin = i * chunk_size;
+        size_t end = (i + 1 == chunk_count) ? bytes.size() : begin + chunk_size;
+        threads.emplace_back([&, i, begin, end] {
+            find_line_starts(bytes.substr(begin, end - begin), base + begin, chunk_results[i]);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // ...and the results are then stitched together
+    size_t total = 0;
+    for (auto& result : chunk_results) {
+        total += result.size();
+    }
+    if (line_starts.size() + total > line_starts.capacity()) {
+        line_starts.reserve(std::max(line_starts.size() + total, 2 * line_starts.capacity()));
+    }
+    for (auto& result : chunk_results) {
+        line_starts.insert(line_starts.end(), result.begin(), result.end());
+        result = std::vector<uint64_t>();
+    }
+}
+
+// ---- LineOffsets ----------------------------------------------------------
+
+void LineOffsets::clear()
+{
+    m_low.clear();
+    m_high_starts.clear();
+}
+
+uint64_t LineOffsets::get_high(size_t number) const
+{
+    // (files under 4 GiB have just one)
+    if (m_high_starts.size() == 1) {
+        return 0u;
+    }
+    auto it = std::upper_bound(m_high_starts.begin(), m_high_starts.end(), number);
+    return uint64_t(it - m_high_starts.begin() - 1) << 32;
+}
+
+void LineOffsets::push_back(uint64_t offset)
+{
+    while (m_high_starts.size() <= (offset >> 32)) {
+        m_high_starts.push_back(m_low.size());
+    }
+    m_low.push_back(uint32_t(offset));
+}
+
+void LineOffsets::append(std::vector<uint64_t> const& offsets)
+{
+    // reserving just the new size would copy the whole index on each of
+    // many small appends (as in follow mode); the capacity grows geometrically
+    auto needed = m_low.size() + offsets.size();
+    if (needed > m_low.capacity()) {
+        m_low.reserve(std::max(needed, 2 * m_low.capacity()));
+    }
+    for (auto offset : offsets) {
+        push_back(offset);
+    }
+}
+
+size_t LineOffsets::find_line(uint64_t offset) const
+{
+    size_t high = offset >> 32;
+    if (m_low.empty()) {
+        return 0;
+    }
+    if (high >= m_high_starts.size()) {
+        return m_low.size() - 1;
+    }
+
+    // among the lines with the same high bits, the low ones decide
+    auto begin = m_low.begin() + m_high_starts[high];
+    auto end = (high + 1 < m_high_starts.size()) ? m_low.begin() + m_high_starts[high + 1] : m_low.end();
+    auto it = std::upper_bound(begin, end, uint32_t(offset));
+    return (it == m_low.begin()) ? 0 : (it - m_low.begin()) - 1;
+}
+
+size_t LineOffsets::get_memory_usage() const
+{
+    return m_low.capacity() * sizeof(uint32_t) + m_high_starts.capacity() * sizeof(size_t);
+}
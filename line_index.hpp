@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+/**
+ * Scans the bytes for line feeds and appends the offset of the line
+ * start following each of them (i.e. the offset of the '\n' plus one)
+ * to `line_starts`. The offsets are relative to `base`, so a chunk of
+ * a bigger buffer can be scanned. Uses SSE2/AVX2 where available.
+ */
+void find_line_starts(std::string_view bytes, uint64_t base, std::vector<uint64_t>& line_starts);
+
+/**
+ * Like find_line_starts(), but splits the bytes into chunks scanned
+ * in parallel and stitches the per-chunk results together in order.
+ * If `thread_count` is zero, one thread per hardware core is used.
+ */
+void find_line_starts_parallel(std::string_view bytes, uint64_t base, std::vector<uint64_t>& line_starts,
+    unsigned thread_count = 0);
+
+/**
+ * The start offsets of the lines of a document, in 4 bytes per line
+ * instead of 8: only the low 32 bits of each offset are kept, and as the
+ * offsets grow monotonically, the high bits are found from the (few)
+ * lines where they change, one per 4 GiB of the document.
+ */
+class LineOffsets {
+protected:
+    std::vector<uint32_t> m_low;        ///< Low 32 bits of every offset.
+    std::vector<size_t> m_high_starts;  ///< [h] = number of the first line starting at h * 4 GiB or past it.
+
+    uint64_t get_high(size_t number) const;
+public:
+    size_t size() const { return m_low.size(); }
+    bool empty() const { return m_low.empty(); }
+    void clear();
+    void reserve(size_t count) { m_low.reserve(count); }
+
+    uint64_t operator[](size_t number) const { return get_high(number) | m_low[number]; }
+    uint64_t back() const { return (*this)[size() - 1]; }
+
+    /// Appends an offset; it must not be smaller than the last one.
+    void push_back(uint64_t offset);
+    void append(std::vector<uint64_t> const& offsets);
+
+    /// Returns the number of the last line starting at the offset or
+    /// before it (0 if there is none).
+    size_t find_line(uint64_t offset) const;
+
+    /// Returns the heap memory held, in bytes.
+    size_t get_memory_usage() const;
+};
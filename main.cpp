@@ -13,12 +13,21 @@
 #include <memory>
 #include <string>
 #include <stdexcept>
+#include <algorithm>
 #include <array>
+#include <cstdlib>
+#include <optional>
+#include <vector>
 #include <iostream>
+#include <thread>
 #include "sdl_wrapper.hpp"
 #include "document.hpp"
 #include "view.hpp"
 #include "settings.hpp"
+#include "file_watcher.hpp"
+#include "trace.hpp"
+#include "widget.hpp"
+#include "container.hpp"
 
 std::array<char const*, 2> DEFAULT_FONT_PATHS = {
     "/usr/share/fonts/liberation/LiberationSans-Regular.ttf",
@@ -31,121 +40,394 @@ int main(int argc, char** argv)
 
     setlocale(LC_ALL,"");
 
-    if (argc < 2) {
+    // usage: app [-f|--follow] file...
+    bool follow = false;
+    std::vector<std::string> file_names;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-f" || arg == "--follow") {
+            follow = true;
+        }
+        else {
+            file_names.push_back(arg);
+        }
+    }
+    if (file_names.empty()) {
         std::cerr << "missing argument (file name)\n";
         return 1;
     }
-    std::string file_name = argv[1];
 
     Settings settings;
 
+    // VIEWER_TRACE=file.json records what the time goes to, and writes it
+    // out as a Chrome trace on exit
+    char const* trace_path = getenv("VIEWER_TRACE");
+    if (trace_path && *trace_path) {
+        trace::set_enabled(true);
+    }
+
     const std::string FONT_NAME = "/usr/share/fonts/liberation/LiberationMono-Regular.ttf";
     auto font = std::make_shared<sdl::Font>(FONT_NAME, settings.font_size);
 
-    auto document = std::make_shared<Document>();
-    document->load(file_name);
-    std::cout << "loaded file: " << file_name << " (" << document->size() << " lines)\n";
+    // each file is indexed in the background while the window already
+    // shows it; a file given twice is loaded once
+    class OpenFile {
+    public:
+        std::string name;
+        std::shared_ptr<Document> document;
+        std::unique_ptr<FileWatcher> watcher;
+        bool loading_reported = false;
+    };
+    std::vector<OpenFile> files;
+    for (auto& file_name : file_names) {
+        auto is_same = [&](OpenFile const& file) { return file.name == file_name; };
+        if (std::find_if(files.begin(), files.end(), is_same) != files.end()) {
+            continue;
+        }
+        auto document = std::make_shared<Document>();
+        document->load_in_background(file_name);
+
+        // in the follow mode, the data appended to the file are shown as they come
+        std::unique_ptr<FileWatcher> watcher;
+        if (follow) {
+            watcher = std::make_unique<FileWatcher>(file_name);
+        }
+        files.push_back(OpenFile { file_name, document, std::move(watcher) });
+    }
 
-    auto window = std::make_unique<sdl::Window>("Viewer - " + file_name, settings.initial_window_size);
+    auto title = "Viewer - " + file_names.front() + (file_names.size() > 1 ? " (+" + std::to_string(file_names.size() - 1) + ")" : "");
+    auto window = std::make_unique<sdl::Window>(title, settings.initial_window_size);
     window->allow_resize();
 
     auto renderer = std::make_unique<sdl::Renderer>(*window);
 
-    View view(document, font, renderer->get_output_size());
+    // one pane per file, side by side; all panes share the glyph atlas and
+    // the rasterizer, and those of the same file share the document and its bounds
+    auto glyph_atlas = std::make_shared<sdl::GlyphAtlas>(*renderer, font);
+    auto rasterizer = std::make_shared<Rasterizer>(*font);
+    HContainer panes;
+    std::vector<std::shared_ptr<View>> views;
+    for (auto& file_name : file_names) {
+        auto is_same = [&](OpenFile const& file) { return file.name == file_name; };
+        auto& file = *std::find_if(files.begin(), files.end(), is_same);
+        auto is_same_document = [&](std::shared_ptr<View> const& view) { return view->get_document() == file.document; };
+        auto sibling = std::find_if(views.begin(), views.end(), is_same_document);
+        auto view = (sibling != views.end()) ? (*sibling)->split()
+            : std::make_shared<View>(file.document, font, renderer->get_output_size(), glyph_atlas, rasterizer);
+        views.push_back(view);
+        panes.add(view);
+    }
+    size_t focused = 0;     // the pane that takes the keyboard and scrolling input
+
+    // the views of a document are refreshed together
+    auto refresh_file = [&](OpenFile& file) {
+        std::vector<View*> file_views;
+        for (auto& view : views) {
+            if (view->get_document() == file.document) {
+                file_views.push_back(view.get());
+            }
+        }
+        if (!file_views.empty()) {
+            View::refresh_document(file_views);
+        }
+
+        // a reopened file is loaded in background; once loaded, it is
+        // reported and caught up with again
+        if (file.document->is_loading()) {
+            file.loading_reported = false;
+        }
+    };
+
+    FrameGraph frame_graph;
 
     auto on_redraw = [&] {
-        view.render(*renderer, settings);
+        trace::begin_frame();
+        panes.render(*renderer, settings);
+        if (settings.show_frame_graph) {
+            auto output_size = renderer->get_output_size();
+            auto sizing = frame_graph.get_sizing_info();
+            frame_graph.set_rect(sdl::Rect(0, output_size.h - sizing.min_height, sizing.min_width, sizing.min_height));
+            frame_graph.render(*renderer, settings);
+        }
         renderer->present();
+        trace::end_frame();
     };
 
-    const uint64_t INTER_FRAME_PERIOD = 16;
-
     sdl::EventQueue events;
 
-    // the event loop
+    // the followed files are watched on threads of their own, which wake
+    // up the event loop with an event when a file changes
+    const uint32_t FILE_CHANGED_EVENT = sdl::register_event_type();
+    std::vector<std::thread> watcher_threads;
+    for (auto& file : files) {
+        if (file.watcher) {
+            watcher_threads.emplace_back([watcher = file.watcher.get(), FILE_CHANGED_EVENT] {
+                while (watcher->wait()) {
+                    if (watcher->poll()) {
+                        sdl::push_event(FILE_CHANGED_EVENT);
+                    }
+                }
+            });
+        }
+    }
+
+    // while work goes on in the background, its progress is checked this often
+    const int BACKGROUND_CHECK_PERIOD = 50;
+
+    // wheel notches per frame from which each notch scrolls by more lines
+    const int WHEEL_ACCELERATION_NOTCHES = 3;
+
+    // the event loop; it sleeps until there is something to do, and draws
+    // a frame only when a view was invalidated
     bool exit_requested = false;
-    bool redraw_now = false;            // if set, redraw frame asap instead of waiting for period
-    uint64_t next_frame_time = sdl::get_ticks();
+    bool search_editing = false;        // if set, typed text goes to the search query
     while (!exit_requested) {
 
-        // handle all pending events
+        for (auto& file : files) {
+            if (!file.loading_reported && !file.document->is_loading()) {
+                auto memory = file.document->get_memory_report();
+                std::cout << "loaded file: " << file.name << " (" << memory.line_count << " lines, "
+                    << memory.get_bytes_per_line() << " bytes of memory per line, overhead "
+                    << memory.get_overhead_ratio() * 100.0 << "% of the file size)\n";
+                file.loading_reported = true;
+
+                // catch up with whatever was appended during the loading
+                if (file.watcher) {
+                    refresh_file(file);
+                }
+            }
+        }
+
+        // the panes are laid out again only when the window was resized or
+        // a pane was added or removed, once however many resize events came
+        panes.set_rect(sdl::Rect(0, 0, renderer->get_output_size()));
+
+        bool busy = false;
+        bool dirty = false;
+        View::fill_highlights(views);
+        for (auto& view : views) {
+            busy = view->check_background_work() || busy;
+            dirty = dirty || view->is_dirty();
+        }
+        if (dirty) {
+            on_redraw();
+        }
+
+        // scrolling input is folded into one move per frame, however many
+        // events came; a scrollbar drag overrides what came before it
+        // (a change of focus starts the folding over)
+        int scroll_lines = 0;           // down (negative: up)
+        int wheel_notches = 0;          // down (negative: up)
+        int scroll_blocks = 0;          // right (negative: left)
+        std::optional<int> indicator_position;
+        auto drag_to_indicator = [&](int y) {
+            indicator_position = std::max(y - views[focused]->get_rect().y, 0);
+            scroll_lines = 0;
+            wheel_notches = 0;
+        };
+        auto apply_scrolling = [&] {
+            auto& view = *views[focused];
+
+            // a fast wheel spin moves more lines per notch
+            scroll_lines += wheel_notches * (1 + std::abs(wheel_notches) / WHEEL_ACCELERATION_NOTCHES);
+            if (indicator_position) {
+                view.scroll_to_indicator(*indicator_position);
+            }
+            if (scroll_lines != 0) {
+                view.scroll_lines(scroll_lines);
+            }
+            if (scroll_blocks != 0) {
+                view.scroll_blocks(scroll_blocks);
+            }
+            scroll_lines = wheel_notches = scroll_blocks = 0;
+            indicator_position.reset();
+        };
+
+        // focuses the pane at the point (if any), the scrolling folded so
+        // far going to the pane focused until then
+        auto focus_pane_at = [&](sdl::Point2d point) {
+            for (size_t i = 0; i < views.size(); i++) {
+                if (i != focused && views[i]->is_point_inside(point)) {
+                    apply_scrolling();
+                    focused = i;
+                    search_editing = false;
+                }
+            }
+        };
+
+        // wait for events, then handle all pending ones
         sdl::Event event;
-        while (sdl::poll_event(event)) {
+        bool has_event = sdl::wait_event(event, busy ? BACKGROUND_CHECK_PERIOD : -1);
+        for (; has_event; has_event = sdl::poll_event(event)) {
+            auto& view = *views[focused];
             if (event.type == sdl::EventType::Quit) {
                 exit_requested = true;
                 break;
             }
+            else if (event.type == FILE_CHANGED_EVENT) {
+                for (auto& file : files) {
+                    if (file.watcher) {
+                        refresh_file(file);
+                    }
+                }
+            }
+            else if (event.type == SDL_RENDER_TARGETS_RESET) {
+                for (auto& pane : views) {
+                    pane->invalidate_frame();   // the kept frames are lost
+                }
+            }
+            else if (event.type == sdl::EventType::TextInput && search_editing) {
+                view.edit_search(view.get_search_query() + event.text.text, view.is_search_regex());
+            }
+            else if (event.type == sdl::EventType::KeyDown && search_editing) {
+                auto query = view.get_search_query();
+                if (event.key.keysym.sym == SDLK_ESCAPE) {
+                    view.clear_search();
+                    search_editing = false;
+                }
+                else if (event.key.keysym.sym == SDLK_RETURN) {
+                    search_editing = false;
+                    view.find_next_match();
+                }
+                else if (event.key.keysym.sym == SDLK_BACKSPACE && !query.empty()) {
+
+                    // drop the whole last codepoint, not just its last byte
+                    while (!query.empty() && (query.back() & 0xc0) == 0x80) {
+                        query.pop_back();
+                    }
+                    if (!query.empty()) {
+                        query.pop_back();
+                    }
+                    view.edit_search(query, view.is_search_regex());
+                }
+                else if (event.key.keysym.sym == SDLK_TAB) {
+                    view.edit_search(query, !view.is_search_regex());
+                }
+                view.invalidate();
+            }
             else if (event.type == sdl::EventType::KeyDown) {
+                bool shift = event.key.keysym.mod & KMOD_SHIFT;
+                bool ctrl = event.key.keysym.mod & KMOD_CTRL;
                 if (event.key.keysym.sym == SDLK_ESCAPE) {
-                    exit_requested = true;
-                    break;
+                    if (view.has_search()) {
+                        view.clear_search();
+                    }
+                    else {
+                        exit_requested = true;
+                        break;
+                    }
+                }
+                else if (event.key.keysym.sym == SDLK_f && ctrl) {
+                    view.start_search("", false);
+                    search_editing = true;
+                }
+                else if (event.key.keysym.sym == SDLK_F3 || event.key.keysym.sym == SDLK_n) {
+                    if (shift) {
+                        view.find_previous_match();
+                    }
+                    else {
+                        view.find_next_match();
+                    }
                 }
                 else if (event.key.keysym.sym == SDLK_DOWN) {
-                    view.scroll_line_down();
-                    redraw_now = true;
+                    scroll_lines++;
                 }
                 else if (event.key.keysym.sym == SDLK_UP) {
-                    view.scroll_line_up();
-                    redraw_now = true;
+                    scroll_lines--;
                 }
                 else if (event.key.keysym.sym == SDLK_LEFT) {
-                    view.scroll_block_left();
-                    redraw_now = true;
+                    scroll_blocks--;
                 }
                 else if (event.key.keysym.sym == SDLK_RIGHT) {
-                    view.scroll_block_right();
-                    redraw_now = true;
+                    scroll_blocks++;
+                }
+                else if (event.key.keysym.sym == SDLK_F7) {
+                    settings.use_highlighting = !settings.use_highlighting;
+                    for (auto& pane : views) {
+                        pane->invalidate();
+                    }
+                }
+                else if (event.key.keysym.sym == SDLK_F12) {
+                    settings.show_frame_graph = !settings.show_frame_graph;
+                    if (settings.show_frame_graph) {
+                        trace::set_enabled(true);
+                    }
+                    else if (!trace_path || !*trace_path) {
+                        trace::set_enabled(false);
+                    }
+                    view.invalidate();
                 }
                 else if (event.key.keysym.sym == SDLK_HOME) {
+                    scroll_blocks = 0;
                     view.scroll_x = 0;
-                    redraw_now = true;
+                    view.invalidate();
                 }
-            }
-            else if (event.type == sdl::EventType::MouseWheel) {
-                if (event.wheel.y < 0) {
-                    view.scroll_line_down();
-                    redraw_now = true;
+                else if (event.key.keysym.sym == SDLK_z && (event.key.keysym.mod & KMOD_ALT)) {
+                    apply_scrolling();
+                    view.set_wrap(!view.is_wrapped());
+                }
+                else if (event.key.keysym.sym == SDLK_F2) {
+
+                    // another pane on the same document, next to the focused one
+                    apply_scrolling();
+                    auto pane = view.split();
+                    focused++;
+                    views.insert(views.begin() + focused, pane);
+                    panes.insert(focused, pane);
                 }
-                else if (event.wheel.y > 0) {
-                    view.scroll_line_up();
-                    redraw_now = true;
+                else if (event.key.keysym.sym == SDLK_w && ctrl && views.size() > 1) {
+                    apply_scrolling();
+                    panes.remove(views[focused]);
+                    views.erase(views.begin() + focused);
+                    focused = std::min(focused, views.size() - 1);
                 }
+                else if (event.key.keysym.sym == SDLK_TAB && ctrl) {
+                    apply_scrolling();
+                    focused = (focused + (shift ? views.size() - 1 : 1)) % views.size();
+                }
+            }
+            else if (event.type == sdl::EventType::MouseWheel) {
+                int x, y;
+                SDL_GetMouseState(&x, &y);
+                focus_pane_at(sdl::Point2d(x, y));
+                wheel_notches -= event.wheel.y;
             }
             else if (event.type == sdl::EventType::MouseButtonDown) {
-                if (view.get_scrollbar().is_point_inside(sdl::Point2d(event.button.x, event.button.y))) {
-                    view.scroll_to_indicator(event.button.y);
-                    redraw_now = true;
+                auto point = sdl::Point2d(event.button.x, event.button.y);
+                focus_pane_at(point);
+                if (views[focused]->get_scrollbar().is_point_inside(point)) {
+                    drag_to_indicator(event.button.y);
                 }
             }
             else if (event.type == sdl::EventType::MouseMotion) {
                 if (event.motion.state & SDL_BUTTON_LMASK) {
                     if (view.get_scrollbar().is_point_inside(sdl::Point2d(event.motion.x, event.motion.y))) {
                         if (event.motion.y >= 0) {
-                            view.scroll_to_indicator(event.motion.y);
+                            drag_to_indicator(event.motion.y);
                         }
                     }
-                    redraw_now = true;
                 }
             }
             else if (event.type == sdl::EventType::WindowEvent) {
-                if (event.window.event == SDL_WINDOWEVENT_RESIZED) {
-                    view.update_viewport_size(*renderer);
-                    redraw_now = true;
+                if (event.window.event == SDL_WINDOWEVENT_EXPOSED) {
+                    for (auto& pane : views) {
+                        pane->invalidate();
+                    }
                 }
             }
         }
+        apply_scrolling();
+    }
 
-        if (exit_requested) { break; }
-
-        // draw frame
-        uint64_t now = sdl::get_ticks();
-        if (redraw_now || now > next_frame_time) {
-            on_redraw();
-            next_frame_time = sdl::get_ticks() + INTER_FRAME_PERIOD;
-        }
-        else {
-            SDL_Delay(next_frame_time - now);
+    for (auto& file : files) {
+        if (file.watcher) {
+            file.watcher->interrupt();
         }
-        redraw_now = false;
+    }
+    for (auto& thread : watcher_threads) {
+        thread.join();
+    }
+    if (trace_path && *trace_path && !trace::write_chrome_trace(trace_path)) {
+        std::cerr << "could not write the trace: " << trace_path << "\n";
     }
 }
@@ -0,0 +1,254 @@
+#include "rasterizer.hpp"
+#include "trace.hpp"
+#include "utf8.hpp"
+#include <algorithm>
+
+std::string join_line_pieces(Line& line)
+{
+    std::string text;
+    for (auto& piece : line.pieces) {
+        if (!text.empty()) {
+            text.push_back(' ');
+        }
+        text.append(piece.get_text());
+    }
+    return text;
+}
+
+static size_t get_surface_bytes(sdl::Surface& surface)
+{
+    return size_t(surface.peek()->pitch) * surface.peek()->h;
+}
+
+static uint64_t get_glyph_id(uint32_t font_size, uint32_t codepoint)
+{
+    return (uint64_t(font_size) << 32) | codepoint;
+}
+
+Rasterizer::Rasterizer(sdl::Font& font)
+{
+    // one core is left to the render thread
+    auto count = std::clamp<size_t>(std::thread::hardware_concurrency(), 2u, MAX_WORKERS + 1) - 1;
+    for (size_t i = 0; i < count; i++) {
+        m_fonts.push_back(std::make_unique<sdl::Font>(font.get_path(), font.get_size()));
+    }
+    for (auto& copy : m_fonts) {
+        m_workers.emplace_back([this, &copy = *copy] { run(copy); });
+    }
+}
+
+Rasterizer::~Rasterizer()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_stop_requested = true;
+    }
+    m_job_queued.notify_all();
+    for (auto& worker : m_workers) {
+        worker.join();
+    }
+}
+
+void Rasterizer::run(sdl::Font& font)
+{
+    std::unique_lock lock(m_mutex);
+    while (true) {
+        m_job_queued.wait(lock, [this] { return m_stop_requested || !m_jobs.empty(); });
+        if (m_stop_requested) {
+            return;
+        }
+        auto job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+        auto& request = *job.request;
+        auto document = request.document.get();
+        m_reading.insert(document);
+        try {
+            trace::Scope scope("Rasterizer::rasterize");
+            if (font.get_size() != request.font_size) {
+                font.set_size(request.font_size);
+            }
+            rasterize_line(font, request, job.line, lock);
+        }
+        catch (std::exception& e) {
+            // left to the render thread, which reports it (a line may also
+            // be gone, e.g. after the file was reopened)
+        }
+        m_reading.erase(m_reading.find(document));
+        m_job_done.notify_all();
+    }
+}
+
+// called and returns with the lock held, which it releases while reading
+// and rendering (the font is the worker's own)
+void Rasterizer::rasterize_line(sdl::Font& font, Request const& request, uint32_t line, std::unique_lock<std::mutex>& lock)
+{
+    auto key = Key(Kind::Line, request.document.get(), line, request.font_size, request.color);
+    if (m_done.contains(key) || m_in_progress.contains(key)) {
+        return;
+    }
+    m_in_progress.insert(key);
+    lock.unlock();
+
+    std::optional<Result> result;
+    try {
+        auto& document = *request.document;
+        if (request.whole_lines && document.get_line_length(line) <= request.max_line_length) {
+            auto text = document.get_line(line);
+            if (!text.empty()) {
+                result.emplace(Result { font.render(join_line_pieces(text), request.color), 0 });
+            }
+        }
+        else {
+            auto text = document.get_line_text(line);
+            rasterize_glyphs(font, request, text.substr(0, request.scan_length), lock);
+        }
+    }
+    catch (...) {
+        if (!lock.owns_lock()) {
+            lock.lock();
+        }
+        m_in_progress.erase(key);
+        throw;
+    }
+
+    lock.lock();
+    m_in_progress.erase(key);
+    if (result) {
+        store(key, std::move(*result));
+    }
+}
+
+// called and returns without the lock
+void Rasterizer::rasterize_glyphs(sdl::Font& font, Request const& request, std::string_view text, std::unique_lock<std::mutex>& lock)
+{
+    // the codepoints on the line, just once each
+    std::vector<uint32_t> codepoints;
+    for (size_t pos = 0; pos < text.size(); ) {
+        auto codepoint = utf8::next_codepoint(text, pos);
+        if (codepoint != ' ' && codepoint != '\t' && std::find(codepoints.begin(), codepoints.end(), codepoint) == codepoints.end()) {
+            codepoints.push_back(codepoint);
+        }
+    }
+
+    // those not rasterized before are claimed, then rendered one by one
+    lock.lock();
+    std::erase_if(codepoints, [&](uint32_t codepoint) {
+        return !m_glyphs_known.insert(get_glyph_id(request.font_size, codepoint)).second;
+    });
+    lock.unlock();
+    for (auto codepoint : codepoints) {
+        std::optional<Result> result;
+        try {
+            auto advance = font.get_glyph_metrics(codepoint).advance;
+            result.emplace(Result { font.render_glyph(codepoint, sdl::Color::WHITE).convert(SDL_PIXELFORMAT_ARGB8888), advance });
+        }
+        catch (std::exception& e) {
+            // unclaimed, so that it can be tried again
+        }
+        lock.lock();
+        if (result) {
+            store(Key(Kind::Glyph, nullptr, codepoint, request.font_size, sdl::Color::WHITE), std::move(*result));
+        }
+        else {
+            m_glyphs_known.erase(get_glyph_id(request.font_size, codepoint));
+        }
+        lock.unlock();
+    }
+}
+
+void Rasterizer::store(Key const& key, Result&& result)
+{
+    if (m_done.contains(key)) {
+        return;
+    }
+    m_done_bytes += get_surface_bytes(result.surface);
+    m_done.emplace(key, std::move(result));
+    m_done_order.push_back(key);
+    while (m_done_bytes > MAX_DONE_BYTES) {
+        drop_oldest();
+    }
+}
+
+void Rasterizer::drop_oldest()
+{
+    auto key = m_done_order.front();
+    m_done_order.pop_front();
+    auto it = m_done.find(key);
+    if (it != m_done.end()) {
+        m_done_bytes -= get_surface_bytes(it->second.surface);
+        m_done.erase(it);
+
+        // a glyph dropped before it was taken is rasterized again when next seen
+        if (key.kind == Kind::Glyph) {
+            m_glyphs_known.erase(get_glyph_id(key.font_size, key.number));
+        }
+    }
+}
+
+void Rasterizer::prefetch(Request&& request)
+{
+    auto shared = std::make_shared<Request const>(std::move(request));
+    {
+        std::lock_guard lock(m_mutex);
+        std::erase_if(m_jobs, [&](Job const& job) { return job.request->requester == shared->requester; });
+        for (auto line : shared->lines) {
+            m_jobs.push_back(Job { shared, line });
+        }
+
+        // the keys taken are left in the order until they come up, unless
+        // there are many more of them than of the results
+        if (m_done_order.size() > 2 * m_done.size() + 1024) {
+            std::erase_if(m_done_order, [this](Key const& key) { return !m_done.contains(key); });
+        }
+    }
+    m_job_queued.notify_all();
+}
+
+std::optional<Rasterizer::Result> Rasterizer::take(Key const& key)
+{
+    std::unique_lock lock(m_mutex);
+    m_job_done.wait(lock, [&] { return !m_in_progress.contains(key); });
+    auto it = m_done.find(key);
+    if (it == m_done.end()) {
+        std::erase_if(m_jobs, [&](Job const& job) {
+            return job.line == key.number && job.request->document.get() == key.document;
+        });
+        return std::nullopt;
+    }
+    m_done_bytes -= get_surface_bytes(it->second.surface);
+    std::optional<Result> result(std::move(it->second));
+    m_done.erase(it);
+    return result;
+}
+
+std::vector<std::pair<Rasterizer::Key, Rasterizer::Result>> Rasterizer::take_glyphs()
+{
+    std::lock_guard lock(m_mutex);
+    std::vector<std::pair<Key, Result>> results;
+    for (auto it = m_done.begin(); it != m_done.end(); ) {
+        if (it->first.kind != Kind::Glyph) {
+            it++;
+            continue;
+        }
+        m_done_bytes -= get_surface_bytes(it->second.surface);
+        results.emplace_back(it->first, std::move(it->second));
+        it = m_done.erase(it);
+    }
+    return results;
+}
+
+void Rasterizer::forget(Document const* document)
+{
+    std::unique_lock lock(m_mutex);
+    std::erase_if(m_jobs, [&](Job const& job) { return job.request->document.get() == document; });
+    m_job_done.wait(lock, [&] { return !m_reading.contains(document); });
+    for (auto it = m_done.begin(); it != m_done.end(); ) {
+        if (it->first.document == document) {
+            m_done_bytes -= get_surface_bytes(it->second.surface);
+            it = m_done.erase(it);
+        }
+        else {
+            it++;
+        }
+    }
+}
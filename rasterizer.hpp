@@ -0,0 +1,141 @@
+#pragma once
+
+#include "sdl_wrapper.hpp"
+#include "document.hpp"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/// The text of the line as drawn: its pieces joined by single spaces.
+std::string join_line_pieces(Line& line);
+
+/**
+ * A pool of workers that rasterize text ahead of time, into surfaces
+ * (in memory), so that the render thread only has to upload them. One
+ * rasterizer serves all the views with the same font.
+ *
+ * A view asks for the lines it expects to draw next, nearest first, as
+ * just their numbers: the workers read the lines and rasterize either
+ * the whole lines (for the line textures), or the glyphs on them that
+ * they have not rasterized yet (for the glyph atlas). Each request replaces
+ * the jobs of the same view still queued, as the view has moved on. Each
+ * worker has its own copy of the font, as a font cannot be used by two
+ * threads at once.
+ *
+ * The surfaces done are kept until taken, up to MAX_DONE_BYTES (the oldest
+ * are dropped first). Nothing is required to be done: a line or a glyph that
+ * is not (e.g. it failed to render, or the atlas was filled up and started
+ * over) is rasterized by the render thread as before.
+ */
+class Rasterizer {
+public:
+    enum class Kind : uint8_t {
+        Line,       ///< A whole line, in a color (see Font::render()).
+        Glyph       ///< A glyph in white, converted to ARGB8888 (see GlyphAtlas).
+    };
+
+    /// Identifies a result: which line (or codepoint), in which font size and color.
+    class Key {
+    public:
+        Kind kind = Kind::Line;
+        Document const* document = nullptr;     ///< Of a line (none for a glyph).
+        uint32_t number = 0u;                   ///< Line number, or codepoint.
+        uint32_t font_size = 0u;
+        uint32_t color = 0u;                    ///< RGBA packed into one number.
+
+        Key() {}
+        Key(Kind kind_, Document const* document_, uint32_t number_, uint32_t font_size_, sdl::Color color_)
+            : kind(kind_), document(document_), number(number_), font_size(font_size_),
+              color((color_.r << 24) | (color_.g << 16) | (color_.b << 8) | color_.a) {}
+        bool operator==(Key const& other) const = default;
+    };
+
+    /// The lines a view expects to draw next.
+    class Request {
+    public:
+        void const* requester = nullptr;        ///< Whose queued jobs the request replaces.
+        std::shared_ptr<Document> document;
+        std::vector<uint32_t> lines;            ///< Nearest first.
+        bool whole_lines = false;               ///< Lines up to max_line_length are rasterized whole.
+        size_t max_line_length = 0u;
+        size_t scan_length = 0u;                ///< Bytes of a line looked through for glyphs.
+        uint32_t font_size = 0u;
+        sdl::Color color;
+    };
+
+    class Result {
+    public:
+        sdl::Surface surface;
+        int32_t advance = 0;        ///< Of a glyph.
+    };
+
+protected:
+    class KeyHash {
+    public:
+        size_t operator()(Key const& key) const {
+            size_t h = std::hash<uint32_t>()(key.number);
+            h = h * 31 + std::hash<Document const*>()(key.document);
+            h = h * 31 + uint8_t(key.kind);
+            h = h * 31 + key.font_size;
+            return h * 31 + key.color;
+        }
+    };
+
+    class Job {
+    public:
+        std::shared_ptr<Request const> request;
+        uint32_t line;
+    };
+
+    std::mutex m_mutex;                         ///< Guards all below but the workers.
+    std::condition_variable m_job_queued;
+    std::condition_variable m_job_done;
+    std::deque<Job> m_jobs;                     ///< Nearest first.
+    std::unordered_set<Key, KeyHash> m_in_progress;     ///< The whole lines being rasterized.
+    std::unordered_multiset<Document const*> m_reading; ///< The documents of the jobs in progress.
+    std::unordered_set<uint64_t> m_glyphs_known;        ///< (font size, codepoint) of the glyphs rasterized (or being), until dropped.
+    std::unordered_map<Key, Result, KeyHash> m_done;
+    std::deque<Key> m_done_order;               ///< Oldest first (may hold keys taken since).
+    size_t m_done_bytes = 0u;
+    bool m_stop_requested = false;
+    std::vector<std::unique_ptr<sdl::Font>> m_fonts;    ///< One per worker (opened and closed on this thread).
+    std::vector<std::thread> m_workers;
+
+    void run(sdl::Font& font);
+    void rasterize_line(sdl::Font& font, Request const& request, uint32_t line, std::unique_lock<std::mutex>& lock);
+    void rasterize_glyphs(sdl::Font& font, Request const& request, std::string_view text, std::unique_lock<std::mutex>& lock);
+    void store(Key const& key, Result&& result);
+    void drop_oldest();
+public:
+    static constexpr size_t MAX_WORKERS = 4u;
+    static constexpr size_t MAX_DONE_BYTES = 32u << 20;
+
+    /// Starts the workers, with copies of the font.
+    explicit Rasterizer(sdl::Font& font);
+    Rasterizer(Rasterizer& other) = delete;
+    ~Rasterizer();
+
+    /// Replaces the queued jobs of the requester with the lines of the request.
+    void prefetch(Request&& request);
+
+    /// Returns the whole line rasterized, waiting for it if it is in progress,
+    /// or nothing if it has not been started (which also drops it from
+    /// the queue, as the caller rasterizes it anyway).
+    std::optional<Result> take(Key const& key);
+
+    /// Returns the glyphs rasterized so far.
+    std::vector<std::pair<Key, Result>> take_glyphs();
+
+    /// Drops the queued jobs and the lines done of the document, and waits
+    /// for the jobs reading it (e.g. before it is refreshed).
+    void forget(Document const* document);
+};
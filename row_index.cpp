@@ -0,0 +1,86 @@
+#include "row_index.hpp"
+#include <bit>
+
+static size_t lowbit(size_t i)
+{
+    return i & (~i + 1);
+}
+
+void RowIndex::clear()
+{
+    m_tree.clear();
+    m_measured.clear();
+}
+
+uint64_t RowIndex::get_prefix(size_t count) const
+{
+    uint64_t sum = 0u;
+    for (size_t i = count; i > 0; i -= lowbit(i)) {
+        sum += m_tree[i];
+    }
+    return sum;
+}
+
+void RowIndex::assign(std::vector<uint32_t> const& rows)
+{
+    // built bottom-up in one pass: each node is complete when reached,
+    // and is added to its parent
+    m_tree.assign(rows.size() + 1, 0u);
+    m_measured.assign(rows.size(), false);
+    for (size_t i = 1; i <= rows.size(); i++) {
+        m_tree[i] += rows[i - 1];
+        auto parent = i + lowbit(i);
+        if (parent <= rows.size()) {
+            m_tree[parent] += m_tree[i];
+        }
+    }
+}
+
+void RowIndex::append(std::vector<uint32_t> const& rows)
+{
+    // each new node sums the lines it covers: its own, plus the ones
+    // before it, found from the (complete) nodes below
+    if (m_tree.empty()) {
+        m_tree.push_back(0u);
+    }
+    for (auto count : rows) {
+        auto i = m_tree.size();
+        m_tree.push_back(count + get_prefix(i - 1) - get_prefix(i - lowbit(i)));
+        m_measured.push_back(false);
+    }
+}
+
+void RowIndex::set_rows(size_t line, uint32_t rows, bool measured)
+{
+    int64_t delta = int64_t(rows) - int64_t(get_rows(line));
+    m_measured[line] = measured;
+    if (delta == 0) {
+        return;
+    }
+    for (size_t i = line + 1; i < m_tree.size(); i += lowbit(i)) {
+        m_tree[i] += delta;
+    }
+}
+
+std::pair<size_t, uint32_t> RowIndex::find_line(uint64_t row) const
+{
+    if (empty()) {
+        return { 0u, 0u };
+    }
+
+    // descend the tree: the largest count of lines whose rows end at
+    // the row or before it
+    size_t count = 0u;
+    uint64_t rows_before = 0u;
+    for (size_t step = std::bit_floor(size()); step > 0; step >>= 1) {
+        if (count + step <= size() && rows_before + m_tree[count + step] <= row) {
+            count += step;
+            rows_before += m_tree[count];
+        }
+    }
+    if (count >= size()) {
+        auto last = size() - 1;
+        return { last, get_rows(last) > 0 ? get_rows(last) - 1 : 0u };
+    }
+    return { count, uint32_t(row - rows_before) };
+}
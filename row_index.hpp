@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * The number of screen rows of every line (with soft wrapping), kept as
+ * a Fenwick tree, so that the first row of a line, the line of a row
+ * and changing the row count of a line all take O(log n).
+ *
+ * The counts of the lines not measured yet are estimates; they are
+ * replaced as the lines are laid out, and the rows of everything below
+ * move accordingly.
+ */
+class RowIndex {
+protected:
+    std::vector<uint64_t> m_tree;       ///< 1-based; [i] = rows of the lines [i - lowbit(i), i).
+    std::vector<bool> m_measured;
+
+    uint64_t get_prefix(size_t count) const;
+public:
+    size_t size() const { return m_measured.size(); }
+    bool empty() const { return m_measured.empty(); }
+    void clear();
+
+    /// Replaces the counts by (estimated) `rows`, in O(n).
+    void assign(std::vector<uint32_t> const& rows);
+
+    /// Appends the estimated counts of more lines.
+    void append(std::vector<uint32_t> const& rows);
+
+    /// Sets the row count of the line; `measured` tells if it is exact.
+    void set_rows(size_t line, uint32_t rows, bool measured = true);
+    uint32_t get_rows(size_t line) const { return get_prefix(line + 1) - get_prefix(line); }
+    bool is_measured(size_t line) const { return m_measured[line]; }
+
+    /// Returns the first row of the line (i.e. the rows of all lines before it).
+    uint64_t get_row(size_t line) const { return get_prefix(line); }
+    uint64_t get_row_count() const { return get_prefix(size()); }
+
+    /// Returns the line the row belongs to, and the row within that line.
+    /// Rows past the end give the last line (with its last row).
+    std::pair<size_t, uint32_t> find_line(uint64_t row) const;
+
+    /// Returns the heap memory held, in bytes.
+    size_t get_memory_usage() const { return m_tree.capacity() * sizeof(uint64_t) + m_measured.capacity() / 8; }
+};
@@ -1,4 +1,6 @@
 #include "sdl_wrapper.hpp"
+#include "utf8.hpp"
+#include "trace.hpp"
 #include <SDL2/SDL_image.h>
 
 void sdl::auto_init() {
@@ -50,6 +52,38 @@ bool sdl::poll_event(SDL_Event& event) {
     return !!SDL_PollEvent(&event);
 }
 
+bool sdl::wait_event(SDL_Event& event, int timeout) {
+    return !!(timeout < 0 ? SDL_WaitEvent(&event) : SDL_WaitEventTimeout(&event, timeout));
+}
+
+uint32_t sdl::register_event_type()
+{
+    auto type = SDL_RegisterEvents(1);
+    if (type == uint32_t(-1)) {
+        throw std::runtime_error("SDL_RegisterEvents() failed: " + sdl::get_error());
+    }
+    return type;
+}
+
+void sdl::push_event(uint32_t type)
+{
+    SDL_Event event {};
+    event.type = type;
+    SDL_PushEvent(&event);
+}
+
+// sdl::Surface --------------------------------------------------------------
+
+sdl::Surface sdl::Surface::convert(uint32_t format)
+{
+    assert(m_inner);
+    auto converted = SDL_ConvertSurfaceFormat(m_inner, format, 0);
+    if (!converted) {
+        throw std::runtime_error("SDL_ConvertSurfaceFormat() failed: " + sdl::get_error());
+    }
+    return sdl::Surface(converted);
+}
+
 // sdl::Texture --------------------------------------------------------------
 
 sdl::Size2d sdl::Texture::get_size()
@@ -67,6 +101,7 @@ sdl::Size2d sdl::Texture::get_size()
 // sdl::Font -----------------------------------------------------------------
 
 sdl::Font::Font(std::string const& name, uint32_t pt_size)
+    : m_path(name), m_pt_size(pt_size)
 {
     m_inner = TTF_OpenFont(name.c_str(), pt_size);
     if (!m_inner) {
@@ -74,23 +109,36 @@ sdl::Font::Font(std::string const& name, uint32_t pt_size)
     }
 }
 
+char const* sdl::Font::to_c_str(std::string_view text)
+{
+    // assign() keeps the capacity, so this stops allocating once warmed up
+    m_text_buffer.assign(text);
+    return m_text_buffer.c_str();
+}
+
 void sdl::Font::set_size(uint32_t pt_size)
 {
     assert(m_inner);
     TTF_SetFontSize(m_inner, pt_size);
+    m_pt_size = pt_size;
+
+    // the advances are different for the new size
+    m_fixed_advance = -1;
+    m_advances.clear();
 }
 
-sdl::Surface sdl::Font::render(std::string text, SDL_Color color)
+sdl::Surface sdl::Font::render(std::string_view text, SDL_Color color)
 {
     assert(m_inner);
-    SDL_Surface* surf = TTF_RenderUTF8_Blended(m_inner, text.c_str(), color);
+    trace::Scope scope("TTF_RenderUTF8_Blended");
+    SDL_Surface* surf = TTF_RenderUTF8_Blended(m_inner, to_c_str(text), color);
     if (!surf) {
         throw std::runtime_error("TTF_RenderUTF8_Blended() failed: " + std::string(TTF_GetError()));
     }
     return sdl::Surface(surf);
 }
 
-sdl::Texture sdl::Font::render_to_texture(sdl::Renderer& renderer, std::string text, SDL_Color color)
+sdl::Texture sdl::Font::render_to_texture(sdl::Renderer& renderer, std::string_view text, SDL_Color color)
 {
     assert(m_inner);
     auto surf = render(text, color);
@@ -99,26 +147,83 @@ sdl::Texture sdl::Font::render_to_texture(sdl::Renderer& renderer, std::string t
     // surf is automatically freed
 }
 
-sdl::Surface sdl::Font::render_wrapped(std::string text, SDL_Color color, uint32_t max_width)
+sdl::Surface sdl::Font::render_glyph(uint32_t codepoint, SDL_Color color)
 {
     assert(m_inner);
-    SDL_Surface* surf = TTF_RenderUTF8_Blended_Wrapped(m_inner, text.c_str(), color, max_width);
+    trace::Scope scope("TTF_RenderGlyph32_Blended");
+    SDL_Surface* surf = TTF_RenderGlyph32_Blended(m_inner, codepoint, color);
+    if (!surf) {
+        throw std::runtime_error("TTF_RenderGlyph32_Blended() failed: " + std::string(TTF_GetError()));
+    }
+    return sdl::Surface(surf);
+}
+
+sdl::Surface sdl::Font::render_wrapped(std::string_view text, SDL_Color color, uint32_t max_width)
+{
+    assert(m_inner);
+    trace::Scope scope("TTF_RenderUTF8_Blended_Wrapped");
+    SDL_Surface* surf = TTF_RenderUTF8_Blended_Wrapped(m_inner, to_c_str(text), color, max_width);
     if (!surf) {
         throw std::runtime_error("TTF_RenderUTF8_Blended_Wrapped() failed: " + std::string(TTF_GetError()));
     }
     return sdl::Surface(surf);
 }
 
-sdl::Size2d sdl::Font::calc_rendered_size(std::string text)
+sdl::Size2d sdl::Font::calc_rendered_size(std::string_view text)
 {
     assert(m_inner);
     int width = 0, height = 0;
-    if (0 != TTF_SizeUTF8(m_inner, text.c_str(), &width, &height)) {
+    if (0 != TTF_SizeUTF8(m_inner, to_c_str(text), &width, &height)) {
         throw std::runtime_error("TTF_SizeUTF8() failed: " + std::string(TTF_GetError()));
     }
     return sdl::Size2d(width, height);
 }
 
+uint32_t sdl::Font::calc_text_width(std::string_view text)
+{
+    assert(m_inner);
+    if (!is_fixed_width()) {
+        return calc_rendered_size(text).w;
+    }
+    if (m_fixed_advance < 0) {
+        m_fixed_advance = get_glyph_metrics('M').advance;
+    }
+
+    int64_t width = int64_t(utf8::count_codepoints(text)) * m_fixed_advance;
+    if (utf8::is_ascii(text)) {
+        return width;
+    }
+
+    // correct the width for the codepoints that have a different advance
+    size_t pos = 0;
+    while (pos < text.size()) {
+        if (static_cast<uint8_t>(text[pos]) < 0x80) {
+            pos++;
+            continue;
+        }
+        bool counted = (static_cast<uint8_t>(text[pos]) & 0xc0) != 0x80;
+        auto codepoint = utf8::next_codepoint(text, pos);
+        width += get_advance(codepoint) - (counted ? m_fixed_advance : 0);
+    }
+    return std::max<int64_t>(width, 0);
+}
+
+int32_t sdl::Font::get_advance(uint32_t codepoint)
+{
+    auto it = m_advances.find(codepoint);
+    if (it != m_advances.end()) {
+        return it->second;
+    }
+
+    // a missing glyph is drawn as a box with the advance of the font
+    int32_t advance = m_fixed_advance;
+    if (has_glyph(codepoint)) {
+        advance = get_glyph_metrics(codepoint).advance;
+    }
+    m_advances.emplace(codepoint, advance);
+    return advance;
+}
+
 bool sdl::Font::has_glyph(uint32_t codepoint)
 {
     assert(m_inner);
@@ -134,7 +239,7 @@ sdl::GlyphMetrics sdl::Font::get_glyph_metrics(uint32_t codepoint)
     }
     return sdl::GlyphMetrics {
         .codepoint = codepoint,
-        .extents = Extents2d(minx, miny, maxx, maxy),
+        .extents = Extents2d(minx, maxx, miny, maxy),
         .advance = advance
     };
 }
@@ -151,9 +256,9 @@ uint32_t sdl::Font::get_space_width()
 
 // sdl::Renderer -------------------------------------------------------------
 
-sdl::Renderer::Renderer(sdl::Window& window)
+sdl::Renderer::Renderer(sdl::Window& window, uint32_t flags)
 {
-    m_inner = SDL_CreateRenderer(window.peek(), -1, SDL_RENDERER_ACCELERATED);
+    m_inner = SDL_CreateRenderer(window.peek(), -1, flags);
     if (!m_inner) {
         throw std::runtime_error("SDL_CreateRenderer() failed: " + sdl::get_error());
     }
@@ -184,6 +289,7 @@ sdl::Texture sdl::Renderer::make_texture(uint32_t format, uint32_t access, Size2
 
 sdl::Texture sdl::Renderer::texture_from_surface(sdl::Surface& surface)
 {
+    trace::Scope scope("SDL_CreateTextureFromSurface");
     auto tex = SDL_CreateTextureFromSurface(m_inner, surface);
     if (!tex) {
         throw std::runtime_error("SDL_CreateTextureFromSurface() failed: " + sdl::get_error());
@@ -210,6 +316,7 @@ void sdl::Renderer::put_texture(Texture& tex, sdl::Point2d topleft)
 
 void sdl::Renderer::put_texture(Texture& tex, SDL_Rect target)
 {
+    trace::Scope scope("SDL_RenderCopy");
     if (0 != SDL_RenderCopy(m_inner, tex, nullptr, &target)) {
         throw std::runtime_error("SDL_RenderCopy() failed: " + sdl::get_error());
     }
@@ -217,12 +324,41 @@ void sdl::Renderer::put_texture(Texture& tex, SDL_Rect target)
 
 void sdl::Renderer::put_texture_part(Texture& tex, SDL_Rect target, SDL_Rect source)
 {
+    trace::Scope scope("SDL_RenderCopy");
     if (0 != SDL_RenderCopy(m_inner, tex.peek(), &source, &target)) {
         throw std::runtime_error("SDL_RenderCopy() failed: " + sdl::get_error());
     }
 }
 
-void sdl::Renderer::put_text(Font& font, sdl::Point2d topleft, std::string text, sdl::Color color)
+void sdl::Renderer::set_target(Texture* tex)
+{
+    if (0 != SDL_SetRenderTarget(m_inner, tex ? tex->peek() : nullptr)) {
+        throw std::runtime_error("SDL_SetRenderTarget() failed: " + sdl::get_error());
+    }
+}
+
+void sdl::Renderer::set_clip_rect(SDL_Rect rect)
+{
+    SDL_RenderSetClipRect(m_inner, &rect);
+}
+
+void sdl::Renderer::reset_clip_rect()
+{
+    SDL_RenderSetClipRect(m_inner, nullptr);
+}
+
+void sdl::Renderer::put_geometry(Texture& tex, std::vector<SDL_Vertex> const& vertices, std::vector<int> const& indices)
+{
+    if (indices.empty()) {
+        return;
+    }
+    trace::Scope scope("SDL_RenderGeometry");
+    if (0 != SDL_RenderGeometry(m_inner, tex, vertices.data(), vertices.size(), indices.data(), indices.size())) {
+        throw std::runtime_error("SDL_RenderGeometry() failed: " + sdl::get_error());
+    }
+}
+
+void sdl::Renderer::put_text(Font& font, sdl::Point2d topleft, std::string_view text, sdl::Color color)
 {
     auto surface = font.render(text, color);
     auto texture = texture_from_surface(surface);
@@ -231,6 +367,7 @@ void sdl::Renderer::put_text(Font& font, sdl::Point2d topleft, std::string text,
 
 void sdl::Renderer::present()
 {
+    trace::Scope scope("present");
     SDL_RenderPresent(m_inner);
 }
 
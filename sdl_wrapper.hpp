@@ -5,9 +5,13 @@
 #include <SDL2/SDL_ttf.h>
 #include <functional>
 #include <string>               // std::string
+#include <string_view>          // std::string_view
 #include <stdexcept>            // std::runtime_error, std::logic_error
 #include <cstdint>              // uint32_t, int32_t etc.
 #include <cassert>              // assert()
+#include <utility>              // std::exchange()
+#include <vector>               // std::vector
+#include <unordered_map>        // std::unordered_map
 
 namespace sdl {
 
@@ -39,6 +43,7 @@ using Event = SDL_Event;
 enum EventType : uint32_t {
     Quit            = SDL_QUIT,
     KeyDown         = SDL_KEYDOWN,
+    TextInput       = SDL_TEXTINPUT,
     MouseWheel      = SDL_MOUSEWHEEL,
     MouseButtonDown = SDL_MOUSEBUTTONDOWN,
     MouseButtonUp   = SDL_MOUSEBUTTONUP,
@@ -48,6 +53,16 @@ enum EventType : uint32_t {
 
 bool poll_event(SDL_Event& event);
 
+/// Waits for an event, at most `timeout` ms (or forever if negative).
+/// Returns false if none came.
+bool wait_event(SDL_Event& event, int timeout);
+
+/// Allocates an application-defined event type.
+uint32_t register_event_type();
+
+/// Pushes an event of the type to the queue; can be called from any thread.
+void push_event(uint32_t type);
+
 class Color : public SDL_Color {
 public:
     Color() {
@@ -108,6 +123,8 @@ public:
     Rect(Point2d topleft, Size2d size) { x = topleft.x; y = topleft.y; w = size.w; h = size.h; }
     Rect(SDL_Rect &source) : SDL_Rect(source) {}
 
+    bool operator==(Rect const& other) const { return x == other.x && y == other.y && w == other.w && h == other.h; }
+
     // empty(), is_empty() are aliases
     bool empty() const { return SDL_RectEmpty(this); }
     bool is_empty() const { return SDL_RectEmpty(this); }
@@ -130,7 +147,7 @@ protected:
 public:
     Wrapper() { m_inner = nullptr; }
     Wrapper(Wrapper<T> const&) = delete;
-    Wrapper(Wrapper<T>&& orig) = default;
+    Wrapper(Wrapper<T>&& orig) : m_inner(std::exchange(orig.m_inner, nullptr)) {}
     Wrapper& operator=(Wrapper<T> const&) = delete;
     virtual ~Wrapper() {}
     T* peek() { return m_inner; }
@@ -142,7 +159,11 @@ public:
     Surface(Surface&& other) = default;
     explicit Surface(SDL_Surface* wrapped) { assert(wrapped); m_inner = wrapped; }
     operator SDL_Surface*() { assert(m_inner); return m_inner; }
+    ~Surface() { if (m_inner) { SDL_FreeSurface(m_inner); } }
     Size2d get_size() { assert(m_inner); return Size2d(m_inner->w, m_inner->h); }
+
+    /// Returns a copy of the surface converted to the given pixel format.
+    Surface convert(uint32_t format);
 };
 
 class Texture : public Wrapper<SDL_Texture> {
@@ -165,6 +186,20 @@ public:
 class Renderer;
 
 class Font : public Wrapper<TTF_Font> {
+protected:
+    /// Reused for passing text views as NUL-terminated strings to TTF.
+    std::string m_text_buffer;
+
+    std::string m_path;         ///< The file the font was opened from (if known).
+    uint32_t m_pt_size = 0;
+
+    // for fixed-width fonts: the common advance, and the advances of all
+    // non-ASCII codepoints met so far (wide or missing glyphs may differ)
+    int32_t m_fixed_advance = -1;
+    std::unordered_map<uint32_t, int32_t> m_advances;
+
+    char const* to_c_str(std::string_view text);
+    int32_t get_advance(uint32_t codepoint);
 public:
     Font(Font& other) = delete;
     Font(Font&& other) = default;
@@ -173,6 +208,8 @@ public:
     operator TTF_Font*() { return m_inner; }
     ~Font() { if (m_inner) { TTF_CloseFont(m_inner); } }
     void set_size(uint32_t pt_size);
+    uint32_t get_size() { return m_pt_size; }
+    std::string const& get_path() { return m_path; }
     bool is_fixed_width()   { assert(m_inner); return TTF_FontFaceIsFixedWidth(m_inner); }
     uint32_t get_line_skip() { assert(m_inner); return TTF_FontLineSkip(m_inner); }
     uint32_t get_ascent()   { assert(m_inner); return TTF_FontAscent(m_inner); }
@@ -180,17 +217,26 @@ public:
 
     /// Renders the given text using this font and color into a newly
     /// produced surface. The background of the surface is transparent.
-    sdl::Surface render(std::string text, SDL_Color color);
+    sdl::Surface render(std::string_view text, SDL_Color color);
 
     /// Renders the given text using this font and color into a texture
     /// compatible with the renderer. The background is transparent.
-    sdl::Texture render_to_texture(sdl::Renderer& renderer, std::string text, SDL_Color color);
+    sdl::Texture render_to_texture(sdl::Renderer& renderer, std::string_view text, SDL_Color color);
 
     /// Calculates the size of the surface that would be produced
     /// by rendering the given text with this font.
-    sdl::Size2d calc_rendered_size(std::string text);
+    sdl::Size2d calc_rendered_size(std::string_view text);
+
+    /// Calculates the width of the rendered text. For fixed-width fonts,
+    /// this is plain arithmetic (codepoint count times the advance)
+    /// instead of a layout by TTF.
+    uint32_t calc_text_width(std::string_view text);
+
+    /// Renders a single glyph into a newly produced surface
+    /// with a transparent background.
+    sdl::Surface render_glyph(uint32_t codepoint, SDL_Color color);
 
-    sdl::Surface render_wrapped(std::string text, SDL_Color color, uint32_t max_width);
+    sdl::Surface render_wrapped(std::string_view text, SDL_Color color, uint32_t max_width);
 
     /// Checks if the font contains a glyph with that codepoint.
     bool has_glyph(uint32_t codepoint);
@@ -206,7 +252,7 @@ public:
     Renderer(Renderer& other) = delete;
     Renderer(Renderer&& other) = default;
     explicit Renderer(SDL_Renderer* wrapped) { assert(wrapped); m_inner = wrapped; }
-    explicit Renderer(Window& window);
+    explicit Renderer(Window& window, uint32_t flags = SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE);
     ~Renderer();
     Size2d get_output_size();
     Texture make_texture(uint32_t format, uint32_t access, Size2d size);
@@ -217,7 +263,18 @@ public:
     void put_texture(Texture& tex, sdl::Point2d topleft);
     void put_texture(Texture& tex, SDL_Rect target);
     void put_texture_part(Texture& tex, SDL_Rect target, SDL_Rect source);
-    void put_text(Font& font, sdl::Point2d topleft, std::string text, sdl::Color color);
+
+    /// Directs the drawing into the texture (made with SDL_TEXTUREACCESS_TARGET),
+    /// or back to the window if null.
+    void set_target(Texture* tex);
+
+    /// Limits the drawing to the rectangle, until reset_clip_rect().
+    void set_clip_rect(SDL_Rect rect);
+    void reset_clip_rect();
+
+    /// Draws triangles textured from `tex`, with the vertex colors modulating the texture.
+    void put_geometry(Texture& tex, std::vector<SDL_Vertex> const& vertices, std::vector<int> const& indices);
+    void put_text(Font& font, sdl::Point2d topleft, std::string_view text, sdl::Color color);
     void present();
 };
 
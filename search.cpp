@@ -0,0 +1,349 @@
+#include "search.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#ifdef HAVE_X86_SIMD
+
+// Both of these compare the first and the last byte of the needle at
+// consecutive positions; only where both match, the rest is compared.
+// They return the position where the scalar search should continue.
+
+__attribute__((target("sse2")))
+static size_t find_substring_sse2(std::string_view haystack, std::string_view needle, size_t pos,
+    std::function<void(size_t)> const& on_match)
+{
+    size_t n = needle.size();
+    auto first = _mm_set1_epi8(needle.front());
+    auto last = _mm_set1_epi8(needle.back());
+    for (; pos + n - 1 + 16 <= haystack.size(); pos += 16) {
+        auto block_first = _mm_loadu_si128(reinterpret_cast<__m128i const*>(haystack.data() + pos));
+        auto block_last = _mm_loadu_si128(reinterpret_cast<__m128i const*>(haystack.data() + pos + n - 1));
+        uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)));
+        while (mask) {
+            auto candidate = pos + __builtin_ctz(mask);
+            if (n <= 2 || 0 == memcmp(haystack.data() + candidate + 1, needle.data() + 1, n - 2)) {
+                on_match(candidate);
+            }
+            mask &= mask - 1;
+        }
+    }
+    return pos;
+}
+
+__attribute__((target("avx2")))
+static size_t find_substring_avx2(std::string_view haystack, std::string_view needle, size_t pos,
+    std::function<void(size_t)> const& on_match)
+{
+    size_t n = needle.size();
+    auto first = _mm256_set1_epi8(needle.front());
+    auto last = _mm256_set1_epi8(needle.back());
+    for (; pos + n - 1 + 32 <= haystack.size(); pos += 32) {
+        auto block_first = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(haystack.data() + pos));
+        auto block_last = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(haystack.data() + pos + n - 1));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(block_first, first), _mm256_cmpeq_epi8(block_last, last)));
+        while (mask) {
+            auto candidate = pos + __builtin_ctz(mask);
+            if (n <= 2 || 0 == memcmp(haystack.data() + candidate + 1, needle.data() + 1, n - 2)) {
+                on_match(candidate);
+            }
+            mask &= mask - 1;
+        }
+    }
+    return pos;
+}
+
+static bool has_avx2()
+{
+    static bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+#endif
+
+void find_substring(std::string_view haystack, std::string_view needle, std::function<void(size_t)> const& on_match)
+{
+    if (needle.empty() || needle.size() > haystack.size()) {
+        return;
+    }
+    size_t pos = 0;
+#ifdef HAVE_X86_SIMD
+    if (has_avx2()) {
+        pos = find_substring_avx2(haystack, needle, pos, on_match);
+    }
+    pos = find_substring_sse2(haystack, needle, pos, on_match);
+#endif
+    // the tail (or everything, without SIMD)
+    for (pos = haystack.find(needle, pos); pos != std::string_view::npos; pos = haystack.find(needle, pos + 1)) {
+        on_match(pos);
+    }
+}
+
+// ---- Search ---------------------------------------------------------------
+
+Search::Search(std::shared_ptr<Document> document, std::string query, bool is_regex)
+    : m_document(document), m_byte_size(document->get_byte_size()), m_query(query), m_is_regex(is_regex)
+{
+    if (m_is_regex) {
+        m_regex.emplace(m_query, std::regex::ECMAScript | std::regex::optimize);
+    }
+
+    add_blocks(0);
+    if (m_query.empty()) {
+        m_blocks_done = m_block_matches.size();
+        return;
+    }
+    start_workers();
+}
+
+// splits the bytes from the start on into blocks; their line ends are
+// found by the workers
+void Search::add_blocks(uint64_t start)
+{
+    std::lock_guard lock(m_mutex);
+    if (!m_block_starts.empty()) {
+        m_block_starts.pop_back();
+    }
+    for (; start < m_byte_size; start += BLOCK_SIZE) {
+        m_block_starts.push_back(start);
+    }
+    m_block_starts.push_back(m_byte_size);
+    auto block_count = m_block_starts.size() - 1;
+    m_block_matches.resize(block_count);
+    m_block_done.resize(block_count, false);
+    m_block_ends.resize(block_count);
+    for (size_t block = 0; block < block_count; block++) {
+        if (!m_block_done[block]) {
+            m_block_ends[block] = m_block_starts[block + 1];
+        }
+    }
+}
+
+void Search::extend()
+{
+    auto old_size = m_byte_size;
+    m_byte_size = m_document->get_byte_size();
+    if (m_byte_size <= old_size) {
+        return;
+    }
+
+    // the blocks whose last line reached the old end are searched again,
+    // and so is the last block, which now holds more bytes
+    {
+        std::lock_guard lock(m_mutex);
+        for (size_t block = 0; block < m_block_matches.size(); block++) {
+            bool last = block + 1 == m_block_matches.size();
+            if (m_block_done[block] && (m_block_ends[block] >= old_size || last)) {
+                m_match_count -= m_block_matches[block].size();
+                m_block_matches[block].clear();
+                m_block_done[block] = false;
+                m_blocks_done--;
+            }
+        }
+    }
+    auto last_start = m_block_starts.size() > 1 ? m_block_starts[m_block_starts.size() - 2] : 0u;
+    add_blocks(m_block_starts.size() > 1 ? last_start + BLOCK_SIZE : 0u);
+    if (m_query.empty()) {
+        m_blocks_done = m_block_matches.size();
+    }
+}
+
+Search::~Search()
+{
+    pause();
+}
+
+void Search::start_workers()
+{
+    auto thread_count = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), m_block_matches.size());
+    for (size_t i = 0; i < thread_count; i++) {
+        m_workers.emplace_back([this] { run(); });
+    }
+}
+
+void Search::pause()
+{
+    m_cancel_requested = true;
+    for (auto& worker : m_workers) {
+        worker.join();
+    }
+    m_workers.clear();
+    m_cancel_requested = false;
+}
+
+void Search::resume()
+{
+    if (!m_workers.empty() || is_done()) {
+        return;
+    }
+    m_next_block = 0u;
+    start_workers();
+}
+
+void Search::run()
+{
+    std::vector<SearchMatch> matches;
+    for (;;) {
+        auto block = m_next_block++;
+        if (m_cancel_requested || block >= m_block_matches.size()) {
+            return;
+        }
+        {
+            // (after a pause, the blocks are gone through again)
+            std::lock_guard lock(m_mutex);
+            if (m_block_done[block]) {
+                continue;
+            }
+        }
+
+        matches.clear();
+        auto end = search_block(block, matches);
+
+        // a block cut short is left to be searched after a pause
+        if (m_cancel_requested) {
+            return;
+        }
+        std::lock_guard lock(m_mutex);
+        m_match_count += matches.size();
+        m_block_matches[block] = matches;
+        m_block_ends[block] = end;
+        m_block_done[block] = true;
+        m_blocks_done++;
+    }
+}
+
+uint64_t Search::find_line_end(uint64_t offset, std::string& buffer)
+{
+    while (offset < m_byte_size && !m_cancel_requested) {
+        auto bytes = m_document->read(offset, std::min<uint64_t>(LINE_END_SEARCH_SIZE, m_byte_size - offset), buffer);
+        auto eol = bytes.find('\n');
+        if (eol != std::string_view::npos) {
+            return offset + eol + 1;
+        }
+        if (bytes.empty()) {
+            break;
+        }
+        offset += bytes.size();
+    }
+    return m_byte_size;
+}
+
+uint64_t Search::search_block(size_t block, std::vector<SearchMatch>& matches)
+{
+    // from the first line start in the block to the end of the line the
+    // block ends in (a line longer than a block may leave a block empty)
+    std::string buffer;
+    auto begin = block > 0 ? find_line_end(m_block_starts[block] - 1, buffer) : 0u;
+    auto end = m_block_starts[block + 1] < m_byte_size ? find_line_end(m_block_starts[block + 1] - 1, buffer) : m_byte_size;
+    if (begin >= end) {
+        return end;
+    }
+    auto text = m_document->read(begin, end - begin, buffer);
+
+    if (!m_is_regex) {
+
+        // the occurrences must not overlap
+        uint64_t next_allowed = 0;
+        find_substring(text, m_query, [&](size_t pos) {
+            if (pos >= next_allowed) {
+                matches.push_back(SearchMatch { begin + pos, uint32_t(m_query.size()) });
+                next_allowed = pos + m_query.size();
+            }
+        });
+        return end;
+    }
+
+    // regular expressions are matched line by line
+    size_t line_start = 0;
+    while (line_start < text.size() && !m_cancel_requested) {
+        auto line_end = text.find('\n', line_start);
+        if (line_end == std::string_view::npos) {
+            line_end = text.size();
+        }
+        auto first = text.data() + line_start, last = text.data() + line_end;
+        for (auto it = std::cregex_iterator(first, last, *m_regex); it != std::cregex_iterator(); ++it) {
+            if (it->length() > 0) {
+                matches.push_back(SearchMatch { begin + line_start + it->position(), uint32_t(it->length()) });
+            }
+        }
+        line_start = line_end + 1;
+    }
+    return end;
+}
+
+size_t Search::find_first_block(uint64_t offset) const
+{
+    // the block containing the offset, or an earlier one whose last line reaches past it
+    size_t block = std::upper_bound(m_block_starts.begin(), m_block_starts.end(), offset) - m_block_starts.begin() - 1;
+    while (block > 0 && m_block_ends[block - 1] > offset) {
+        block--;
+    }
+    return block;
+}
+
+size_t Search::get_match_count() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_match_count;
+}
+
+std::vector<SearchMatch> Search::get_matches(uint64_t begin, uint64_t end) const
+{
+    std::vector<SearchMatch> result;
+    std::lock_guard lock(m_mutex);
+
+    auto by_offset = [](SearchMatch const& match, uint64_t offset) { return match.offset < offset; };
+    for (auto block = find_first_block(begin); block < m_block_matches.size() && m_block_starts[block] < end; block++) {
+        if (!m_block_done[block]) {
+            continue;
+        }
+        auto& matches = m_block_matches[block];
+        auto it = std::lower_bound(matches.begin(), matches.end(), begin, by_offset);
+        for (; it != matches.end() && it->offset < end; ++it) {
+            result.push_back(*it);
+        }
+    }
+    return result;
+}
+
+std::optional<SearchMatch> Search::find_next(uint64_t offset) const
+{
+    std::lock_guard lock(m_mutex);
+
+    auto by_offset = [](SearchMatch const& match, uint64_t offset) { return match.offset < offset; };
+    for (auto block = find_first_block(offset); block < m_block_matches.size(); block++) {
+        if (!m_block_done[block]) {
+            continue;
+        }
+        auto& matches = m_block_matches[block];
+        auto it = std::lower_bound(matches.begin(), matches.end(), offset, by_offset);
+        if (it != matches.end()) {
+            return *it;
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<SearchMatch> Search::find_previous(uint64_t offset) const
+{
+    std::lock_guard lock(m_mutex);
+
+    auto by_offset = [](SearchMatch const& match, uint64_t offset) { return match.offset < offset; };
+    size_t block = std::upper_bound(m_block_starts.begin(), m_block_starts.end(), offset) - m_block_starts.begin();
+    block = std::min(block, m_block_matches.size());
+    while (block-- > 0) {
+        if (!m_block_done[block]) {
+            continue;
+        }
+        auto& matches = m_block_matches[block];
+        auto it = std::lower_bound(matches.begin(), matches.end(), offset, by_offset);
+        if (it != matches.begin()) {
+            return *std::prev(it);
+        }
+    }
+    return std::nullopt;
+}
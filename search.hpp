@@ -0,0 +1,106 @@
+#pragma once
+
+#include "document.hpp"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/// A found occurrence, as a range of bytes in the document.
+class SearchMatch {
+public:
+    uint64_t offset = 0u;
+    uint32_t length = 0u;
+};
+
+/**
+ * Calls `on_match` with the offset of every occurrence of the needle
+ * in the haystack, in order. Candidates are found by comparing the first
+ * and the last byte of the needle at 16 or 32 positions at once
+ * (SSE2/AVX2), and only those are compared in full.
+ */
+void find_substring(std::string_view haystack, std::string_view needle, std::function<void(size_t)> const& on_match);
+
+/**
+ * Searches the whole document for a text (or a regular expression) on all
+ * cores. The document bytes are split into blocks of BLOCK_SIZE which
+ * the worker threads take one by one; a block holds the lines that start
+ * in it (each worker finds the line ends around its block, so starting
+ * a search reads nothing on the calling thread). The matches of each
+ * finished block are available right away, so the results stream in
+ * while the search runs. Destroying the search cancels it; pause() stops
+ * the workers for a while (e.g. while the document is refreshed, as they
+ * hold views of its bytes).
+ *
+ * The bytes appended to a followed document are taken in by extend():
+ * the blocks after the old end are added, and those whose last line
+ * reached the old end (it may have been partial) are searched again.
+ */
+class Search {
+protected:
+    std::shared_ptr<Document> m_document;
+    uint64_t m_byte_size;
+    std::string m_query;
+    bool m_is_regex;
+    std::optional<std::regex> m_regex;
+
+    /// Block boundaries; block i holds the lines that start in [i, i+1).
+    std::vector<uint64_t> m_block_starts;
+
+    mutable std::mutex m_mutex;                         ///< Guards the block results.
+    std::vector<std::vector<SearchMatch>> m_block_matches;
+    std::vector<uint64_t> m_block_ends;                 ///< End of the last line of each block done.
+    std::vector<bool> m_block_done;
+    size_t m_match_count = 0u;
+
+    std::atomic<size_t> m_next_block = 0u;
+    std::atomic<size_t> m_blocks_done = 0u;
+    std::atomic<bool> m_cancel_requested = false;
+    std::vector<std::thread> m_workers;
+
+    void add_blocks(uint64_t start);
+    void start_workers();
+    void run();
+    uint64_t find_line_end(uint64_t offset, std::string& buffer);
+    uint64_t search_block(size_t block, std::vector<SearchMatch>& matches);
+    size_t find_first_block(uint64_t offset) const;
+public:
+    const uint64_t BLOCK_SIZE = 4u << 20;
+    const size_t LINE_END_SEARCH_SIZE = 64u << 10;     ///< How much is read at once to find a line end.
+
+    /// Starts the search. Throws std::regex_error for an invalid regular expression.
+    Search(std::shared_ptr<Document> document, std::string query, bool is_regex);
+    Search(Search& other) = delete;
+    ~Search();
+
+    /// Stops the workers, keeping the matches of the blocks done.
+    void pause();
+
+    /// Starts the workers again, on the blocks not done yet.
+    void resume();
+
+    /// Takes in the bytes appended to the document since (while paused;
+    /// resume() then searches them).
+    void extend();
+
+    std::string const& get_query() const { return m_query; }
+    bool is_regex() const { return m_is_regex; }
+    bool is_done() const { return m_blocks_done >= m_block_starts.size() - 1; }
+    size_t get_match_count() const;
+
+    /// Returns the matches found so far that start within [begin, end).
+    std::vector<SearchMatch> get_matches(uint64_t begin, uint64_t end) const;
+
+    /// Returns the first match found so far that starts at or after the offset.
+    std::optional<SearchMatch> find_next(uint64_t offset) const;
+
+    /// Returns the last match found so far that starts before the offset.
+    std::optional<SearchMatch> find_previous(uint64_t offset) const;
+};
@@ -11,5 +11,23 @@ public:
     sdl::Color widget_background_color = sdl::Color(248, 255, 248);
     sdl::Color widget_indicator_color = sdl::Color(127, 127, 255);
     sdl::Color widget_text_color      = sdl::Color(16, 16, 16);
+    sdl::Color search_match_color     = sdl::Color(255, 224, 96);
+    sdl::Color search_current_color   = sdl::Color(255, 160, 48);
     sdl::Size2d initial_window_size = sdl::Size2d(1024, 1280);
+    bool use_glyph_atlas = true;            ///< If false, whole lines are rendered by TTF and cached.
+    size_t line_cache_budget = 64u << 20;   ///< Memory budget of the line texture cache, in bytes.
+    bool show_frame_graph = false;          ///< Overlay of the frame times (toggled by F12).
+    bool use_highlighting = false;          ///< Colors the text by its syntax (toggled by F7; the lines are then not cached whole).
+
+    // the colors of the highlighted text (see HighlightStyle)
+    sdl::Color timestamp_color = sdl::Color(0, 80, 160);
+    sdl::Color error_color     = sdl::Color(192, 0, 0);
+    sdl::Color warning_color   = sdl::Color(160, 88, 0);
+    sdl::Color info_color      = sdl::Color(0, 112, 0);
+    sdl::Color debug_color     = sdl::Color(88, 88, 88);
+    sdl::Color key_color       = sdl::Color(120, 0, 120);
+    sdl::Color string_color    = sdl::Color(144, 48, 0);
+    sdl::Color number_color    = sdl::Color(0, 104, 104);
+    sdl::Color keyword_color   = sdl::Color(0, 0, 176);
+    sdl::Color comment_color   = sdl::Color(72, 104, 72);
 };
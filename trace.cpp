@@ -0,0 +1,134 @@
+#include "trace.hpp"
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+
+std::atomic<bool> trace::g_enabled = false;
+
+namespace {
+
+class Event {
+public:
+    char const* name;
+    uint32_t thread;
+    uint64_t start_us;
+    uint64_t duration_us;
+};
+
+// all guarded by g_mutex
+std::mutex g_mutex;
+std::vector<Event> g_events;        // ring buffer of MAX_EVENTS
+size_t g_next_event = 0u;
+std::vector<trace::Frame> g_frames; // ring buffer of MAX_FRAMES
+size_t g_next_frame = 0u;
+trace::Frame g_current_frame;
+uint32_t g_frame_thread = 0u;       // the thread drawing the current frame (0 if none)
+
+const auto g_start = std::chrono::steady_clock::now();
+
+// threads are numbered from 1 in the order they record something
+std::atomic<uint32_t> g_thread_count = 0u;
+
+uint32_t get_thread_number()
+{
+    thread_local uint32_t number = ++g_thread_count;
+    return number;
+}
+
+} // namespace
+
+void trace::set_enabled(bool enabled)
+{
+    std::lock_guard lock(g_mutex);
+    if (enabled && g_events.empty()) {
+        g_events.resize(MAX_EVENTS);
+    }
+    g_enabled = enabled;
+}
+
+uint64_t trace::get_time_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - g_start).count();
+}
+
+void trace::record(char const* name, uint64_t start_us, uint64_t end_us)
+{
+    auto thread = get_thread_number();
+    std::lock_guard lock(g_mutex);
+    if (g_events.empty()) {
+        return;
+    }
+    g_events[g_next_event % MAX_EVENTS] = Event { name, thread, start_us, end_us - start_us };
+    g_next_event++;
+
+    if (thread == g_frame_thread) {
+        for (auto& phase : g_current_frame.phases) {
+            if (phase.first == name) {
+                phase.second += end_us - start_us;
+                return;
+            }
+        }
+        g_current_frame.phases.emplace_back(name, end_us - start_us);
+    }
+}
+
+void trace::begin_frame()
+{
+    if (!is_enabled()) {
+        return;
+    }
+    std::lock_guard lock(g_mutex);
+    g_current_frame = Frame {};
+    g_current_frame.start_us = get_time_us();
+    g_frame_thread = get_thread_number();
+}
+
+void trace::end_frame()
+{
+    std::lock_guard lock(g_mutex);
+    if (g_frame_thread == 0) {
+        return;
+    }
+    g_current_frame.duration_us = get_time_us() - g_current_frame.start_us;
+    g_frame_thread = 0;
+    if (g_frames.size() < MAX_FRAMES) {
+        g_frames.push_back(std::move(g_current_frame));
+    }
+    else {
+        g_frames[g_next_frame % MAX_FRAMES] = std::move(g_current_frame);
+    }
+    g_next_frame++;
+}
+
+std::vector<trace::Frame> trace::get_frames()
+{
+    std::lock_guard lock(g_mutex);
+    if (g_frames.size() < MAX_FRAMES) {
+        return g_frames;
+    }
+    std::vector<Frame> frames;
+    for (size_t i = 0; i < MAX_FRAMES; i++) {
+        frames.push_back(g_frames[(g_next_frame + i) % MAX_FRAMES]);
+    }
+    return frames;
+}
+
+bool trace::write_chrome_trace(std::string const& path)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) {
+        return false;
+    }
+
+    std::lock_guard lock(g_mutex);
+    auto count = std::min(g_next_event, MAX_EVENTS);
+    fprintf(file, "{\"traceEvents\": [\n");
+    for (size_t i = 0; i < count; i++) {
+        auto& event = g_events[(g_next_event - count + i) % MAX_EVENTS];
+        fprintf(file, "{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %llu, \"dur\": %llu}%s\n",
+            event.name, event.thread, (unsigned long long)event.start_us, (unsigned long long)event.duration_us,
+            (i + 1 < count) ? "," : "");
+    }
+    fprintf(file, "]}\n");
+    return 0 == fclose(file);
+}
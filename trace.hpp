@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Lightweight tracing of where the time goes. A trace::Scope measures
+ * the time until it goes out of scope; the events are kept in a ring
+ * buffer (for export as a Chrome trace_event JSON file, to be opened in
+ * chrome://tracing or Perfetto), and the events of the thread drawing
+ * the frames are summed up per frame and phase (for the frame graph).
+ *
+ * When tracing is off, a scope costs a single relaxed atomic load.
+ * Event names must be string literals (they are kept by pointer).
+ */
+namespace trace {
+
+extern std::atomic<bool> g_enabled;
+
+inline bool is_enabled() { return g_enabled.load(std::memory_order_relaxed); }
+void set_enabled(bool enabled);
+
+/// Microseconds since the start of the program.
+uint64_t get_time_us();
+
+void record(char const* name, uint64_t start_us, uint64_t end_us);
+
+class Scope {
+protected:
+    char const* m_name;
+    uint64_t m_start_us = 0u;
+public:
+    explicit Scope(char const* name) : m_name(name) { if (is_enabled()) { m_start_us = get_time_us(); } }
+    Scope(Scope& other) = delete;
+    ~Scope() { if (m_start_us) { record(m_name, m_start_us, get_time_us()); } }
+};
+
+/// The time of a frame, and how much of it each phase took.
+class Frame {
+public:
+    uint64_t start_us = 0u;
+    uint64_t duration_us = 0u;
+    std::vector<std::pair<char const*, uint64_t>> phases;     ///< Nested phases are included in their parents.
+};
+
+/// Marks the frame boundaries; the events recorded in between on the
+/// same thread are summed up into the frame.
+void begin_frame();
+void end_frame();
+
+/// Returns the last frames recorded (up to MAX_FRAMES), oldest first.
+std::vector<Frame> get_frames();
+const size_t MAX_FRAMES = 256u;
+
+/// Writes the events recorded (up to MAX_EVENTS last ones) as a Chrome
+/// trace_event JSON file. Returns false if the file could not be written.
+bool write_chrome_trace(std::string const& path);
+const size_t MAX_EVENTS = 1u << 18;
+
+} // namespace trace
@@ -0,0 +1,264 @@
+#include "utf8.hpp"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+// continuation bytes (10xxxxxx) are the only ones not starting a codepoint
+static inline bool is_continuation_byte(char c)
+{
+    return (static_cast<uint8_t>(c) & 0xc0) == 0x80;
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("sse2")))
+static size_t count_codepoints_sse2(std::string_view text, size_t& pos)
+{
+    // as signed bytes, continuation bytes are -128..-65
+    auto threshold = _mm_set1_epi8(-65);
+    size_t count = 0;
+    for (; pos + 16 <= text.size(); pos += 16) {
+        auto block = _mm_loadu_si128(reinterpret_cast<__m128i const*>(text.data() + pos));
+        uint32_t mask = _mm_movemask_epi8(_mm_cmpgt_epi8(block, threshold));
+        count += __builtin_popcount(mask);
+    }
+    return count;
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t count_codepoints_avx2(std::string_view text, size_t& pos)
+{
+    auto threshold = _mm256_set1_epi8(-65);
+    size_t count = 0;
+    for (; pos + 32 <= text.size(); pos += 32) {
+        auto block = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(text.data() + pos));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpgt_epi8(block, threshold));
+        count += __builtin_popcount(mask);
+    }
+    return count;
+}
+
+__attribute__((target("sse2")))
+static bool is_ascii_sse2(std::string_view text, size_t& pos)
+{
+    auto any_high = _mm_setzero_si128();
+    for (; pos + 16 <= text.size(); pos += 16) {
+        any_high = _mm_or_si128(any_high, _mm_loadu_si128(reinterpret_cast<__m128i const*>(text.data() + pos)));
+    }
+    return _mm_movemask_epi8(any_high) == 0;
+}
+
+static bool has_avx2()
+{
+    static bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    return supported;
+}
+
+// error bits of the validator; a pair of bytes is invalid if the bits
+// looked up for its first byte (high and low nibble) and for its second
+// byte (high nibble) have one in common
+static const uint8_t TOO_SHORT = 1 << 0;        // lead not followed by a continuation
+static const uint8_t TOO_LONG = 1 << 1;         // continuation after ASCII
+static const uint8_t OVERLONG_3 = 1 << 2;
+static const uint8_t TOO_LARGE = 1 << 3;        // past U+10FFFF
+static const uint8_t SURROGATE = 1 << 4;
+static const uint8_t OVERLONG_2 = 1 << 5;
+static const uint8_t TOO_LARGE_1000 = 1 << 6;
+static const uint8_t OVERLONG_4 = 1 << 6;
+static const uint8_t TWO_CONTS = 1 << 7;        // two continuations, valid only within a 3- or 4-byte sequence
+static const uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+__attribute__((target("avx2")))
+static inline __m256i lookup_nibbles(__m256i nibbles, uint8_t const (&table)[16])
+{
+    auto lane = _mm_loadu_si128(reinterpret_cast<__m128i const*>(table));
+    return _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(lane), nibbles);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i high_nibbles(__m256i bytes)
+{
+    return _mm256_and_si256(_mm256_srli_epi16(bytes, 4), _mm256_set1_epi8(0x0f));
+}
+
+/// Returns the bytes shifted by N, with the last N bytes of `previous` shifted in.
+template <int N>
+__attribute__((target("avx2")))
+static inline __m256i shift_in(__m256i bytes, __m256i previous)
+{
+    return _mm256_alignr_epi8(bytes, _mm256_permute2x128_si256(previous, bytes, 0x21), 16 - N);
+}
+
+/// Advances `pos` over whole blocks of valid text, stopping at the block
+/// where an error shows (which may belong to a sequence starting up to
+/// 3 bytes before it).
+__attribute__((target("avx2")))
+static void skip_valid_avx2(std::string_view text, size_t& pos)
+{
+    static const uint8_t BYTE_1_HIGH[16] = {
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        TOO_SHORT | OVERLONG_2,
+        TOO_SHORT,
+        TOO_SHORT | OVERLONG_3 | SURROGATE,
+        TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,
+    };
+    static const uint8_t BYTE_1_LOW[16] = {
+        CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+        CARRY | OVERLONG_2,
+        CARRY,
+        CARRY,
+        CARRY | TOO_LARGE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+    };
+    static const uint8_t BYTE_2_HIGH[16] = {
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    };
+
+    // a lead byte in the last 3 bytes of a block needs the next block
+    auto max_complete = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, char(0xf0 - 1), char(0xe0 - 1), char(0xc0 - 1));
+
+    auto previous = _mm256_setzero_si256();
+    auto previous_incomplete = _mm256_setzero_si256();
+    for (; pos + 32 <= text.size(); pos += 32) {
+        auto bytes = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(text.data() + pos));
+        // ASCII needs no more checks (but it cannot finish a sequence)
+        auto error = previous_incomplete;
+        if (_mm256_movemask_epi8(bytes) != 0) {
+            auto previous_1 = shift_in<1>(bytes, previous);
+            auto special_cases = _mm256_and_si256(
+                _mm256_and_si256(lookup_nibbles(high_nibbles(previous_1), BYTE_1_HIGH),
+                    lookup_nibbles(_mm256_and_si256(previous_1, _mm256_set1_epi8(0x0f)), BYTE_1_LOW)),
+                lookup_nibbles(high_nibbles(bytes), BYTE_2_HIGH));
+
+            // the 3rd and 4th bytes of a sequence must be continuations
+            // (those are the only places where two continuations may follow)
+            auto is_third_byte = _mm256_subs_epu8(shift_in<2>(bytes, previous), _mm256_set1_epi8(0xe0 - 0x80));
+            auto is_fourth_byte = _mm256_subs_epu8(shift_in<3>(bytes, previous), _mm256_set1_epi8(0xf0 - 0x80));
+            auto must_be_continuation = _mm256_and_si256(_mm256_or_si256(is_third_byte, is_fourth_byte), _mm256_set1_epi8(char(0x80)));
+            error = _mm256_xor_si256(must_be_continuation, special_cases);
+            previous_incomplete = _mm256_subs_epu8(bytes, max_complete);
+        }
+        if (!_mm256_testz_si256(error, error)) {
+            return;
+        }
+        previous = bytes;
+    }
+}
+
+#endif
+
+size_t utf8::count_codepoints(std::string_view text)
+{
+    size_t pos = 0, count = 0;
+#ifdef HAVE_X86_SIMD
+    if (has_avx2()) {
+        count += count_codepoints_avx2(text, pos);
+    }
+    count += count_codepoints_sse2(text, pos);
+#endif
+    for (; pos < text.size(); pos++) {
+        count += !is_continuation_byte(text[pos]);
+    }
+    return count;
+}
+
+// finds the first invalid sequence from `pos`, which must be at the start of a sequence
+static size_t find_invalid_scalar(std::string_view text, size_t pos)
+{
+    while (pos < text.size()) {
+
+        // runs of ASCII, a word at a time
+        uint64_t word;
+        if (pos + sizeof(word) <= text.size()) {
+            memcpy(&word, text.data() + pos, sizeof(word));
+            if ((word & 0x8080808080808080u) == 0) {
+                pos += sizeof(word);
+                continue;
+            }
+        }
+        if (static_cast<uint8_t>(text[pos]) < 0x80) {
+            pos++;
+            continue;
+        }
+
+        // (an actual U+FFFD in the text takes 3 bytes)
+        auto start = pos;
+        if (utf8::next_codepoint(text, pos) == utf8::REPLACEMENT_CHARACTER && pos == start + 1) {
+            return start;
+        }
+    }
+    return text.size();
+}
+
+size_t utf8::find_invalid(std::string_view text)
+{
+    size_t pos = 0;
+#ifdef HAVE_X86_SIMD
+    if (has_avx2()) {
+        skip_valid_avx2(text, pos);
+
+        // the rest is checked from the start of the sequence that was cut
+        // by the block boundary, if any (everything before it is valid)
+        auto start = pos > 3 ? pos - 3 : 0;
+        while (start < pos && is_continuation_byte(text[start])) {
+            start++;
+        }
+        pos = start;
+    }
+#endif
+    return find_invalid_scalar(text, pos);
+}
+
+std::string utf8::sanitize(std::string_view text)
+{
+    std::string result;
+    result.reserve(text.size() + 16);
+    size_t pos = 0;
+    while (pos < text.size()) {
+        auto invalid = pos + find_invalid(text.substr(pos));
+        result.append(text.substr(pos, invalid - pos));
+        if (invalid < text.size()) {
+            result.append("\xef\xbf\xbd");
+            invalid++;
+        }
+        pos = invalid;
+    }
+    return result;
+}
+
+bool utf8::is_ascii(std::string_view text)
+{
+    size_t pos = 0;
+#ifdef HAVE_X86_SIMD
+    if (!is_ascii_sse2(text, pos)) {
+        return false;
+    }
+#endif
+    for (; pos < text.size(); pos++) {
+        if (static_cast<uint8_t>(text[pos]) >= 0x80) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace utf8 {
+
+/// The codepoint substituted for invalid sequences (U+FFFD).
+const uint32_t REPLACEMENT_CHARACTER = 0xfffd;
+
+/**
+ * Decodes the codepoint starting at `pos` and advances `pos` past it.
+ * An invalid or truncated sequence yields REPLACEMENT_CHARACTER and
+ * advances by one byte.
+ */
+inline uint32_t next_codepoint(std::string_view text, size_t& pos)
+{
+    auto byte = [&](size_t i) { return static_cast<uint8_t>(text[i]); };
+    auto is_continuation = [&](size_t i) { return i < text.size() && (byte(i) & 0xc0) == 0x80; };
+
+    uint8_t lead = byte(pos);
+    if (lead < 0x80) {
+        pos++;
+        return lead;
+    }
+
+    size_t length;
+    uint32_t codepoint, min_codepoint;
+    if ((lead & 0xe0) == 0xc0) {
+        length = 2; codepoint = lead & 0x1f; min_codepoint = 0x80;
+    }
+    else if ((lead & 0xf0) == 0xe0) {
+        length = 3; codepoint = lead & 0x0f; min_codepoint = 0x800;
+    }
+    else if ((lead & 0xf8) == 0xf0) {
+        length = 4; codepoint = lead & 0x07; min_codepoint = 0x10000;
+    }
+    else {
+        pos++;
+        return REPLACEMENT_CHARACTER;
+    }
+
+    for (size_t i = 1; i < length; i++) {
+        if (!is_continuation(pos + i)) {
+            pos++;
+            return REPLACEMENT_CHARACTER;
+        }
+        codepoint = (codepoint << 6) | (byte(pos + i) & 0x3f);
+    }
+
+    // reject overlong forms, surrogates and values past the Unicode range
+    if (codepoint < min_codepoint || codepoint > 0x10ffff || (codepoint >= 0xd800 && codepoint <= 0xdfff)) {
+        pos++;
+        return REPLACEMENT_CHARACTER;
+    }
+    pos += length;
+    return codepoint;
+}
+
+/**
+ * Counts the codepoints in the text (that is, the bytes that are not
+ * continuation bytes). Invalid sequences are counted the same way, so the
+ * text should be valid for the count to be meaningful. Uses SSE2/AVX2
+ * where available.
+ */
+size_t count_codepoints(std::string_view text);
+
+/// Checks if the text is plain 7-bit ASCII.
+bool is_ascii(std::string_view text);
+
+/**
+ * Returns the offset of the first invalid sequence in the text (one that
+ * next_codepoint() decodes as REPLACEMENT_CHARACTER, including a sequence
+ * cut short by the end of the text), or the size of the text if it is
+ * all valid. Checks 32 bytes at a time with AVX2 where available (after
+ * Keiser and Lemire, "Validating UTF-8 in less than one instruction per
+ * byte"), and a word at a time for runs of ASCII otherwise.
+ */
+size_t find_invalid(std::string_view text);
+
+/// Returns the text with each invalid sequence replaced by U+FFFD.
+std::string sanitize(std::string_view text);
+
+} // namespace utf8
@@ -1,62 +1,944 @@
 #include "view.hpp"
+#include "trace.hpp"
+#include <cassert>
 
-View::View(std::shared_ptr<Document> document, std::shared_ptr<sdl::Font> font, sdl::Size2d viewport_size_)
-    : m_document(document), m_font(font), viewport_size(viewport_size_)
+View::View(std::shared_ptr<Document> document, std::shared_ptr<sdl::Font> font, sdl::Size2d size,
+    std::shared_ptr<sdl::GlyphAtlas> glyph_atlas, std::shared_ptr<Rasterizer> rasterizer)
+    : m_document(document), m_font(font), m_glyph_atlas(glyph_atlas), m_line_cache(Settings().line_cache_budget),
+      m_rasterizer(rasterizer)
 {
-    document_size = calc_document_bounds(*document, *font);
-    max_lines_shown = viewport_size.h / font->get_line_skip();
+    m_bounds = std::make_shared<DocumentBounds>(document, *font);
+    m_highlights = std::make_shared<HighlightCache>(document, make_highlighter(document->get_path()));
+    if (!m_rasterizer) {
+        m_rasterizer = std::make_shared<Rasterizer>(*font);
+    }
+    set_rect(sdl::Rect(0, 0, size));
+    update_document_size();
+}
+
+std::shared_ptr<View> View::split()
+{
+    return std::shared_ptr<View>(new View(*this));
+}
+
+// (the bounds are shared, not measured again, and so is the rasterizer)
+View::View(View& other)
+    : m_document(other.m_document), m_font(other.m_font), m_glyph_atlas(other.m_glyph_atlas),
+      m_line_cache(other.m_line_cache.get_budget()), m_bounds(other.m_bounds), m_highlights(other.m_highlights),
+      m_rasterizer(other.m_rasterizer)
+{
+    top_line_shown = other.top_line_shown;
+    top_line_row = other.top_line_row;
+    scroll_x = other.scroll_x;
+    m_wrap = other.m_wrap;
+    set_rect(other.m_rect);
+    update_document_size();
+}
+
+void View::layout()
+{
+    // the scrollbar takes the right edge, the text the rest
+    auto old_viewport_size = viewport_size;
+    viewport_size = sdl::Size2d(std::max<int>(m_rect.w - int(SCROLLBAR_WIDTH), 0), std::max<int>(m_rect.h, 0));
+    m_scrollbar.set_rect(sdl::Rect(m_rect.x + viewport_size.w, m_rect.y, m_rect.w - viewport_size.w, m_rect.h));
+    max_lines_shown = viewport_size.h / m_font->get_line_skip();
+    if (viewport_size.w != old_viewport_size.w || viewport_size.h != old_viewport_size.h) {
+        scroll_x = 0;
+    }
+    invalidate_frame();
 }
 
 const uint32_t PADDING_TOP = 4;
 
 void View::render(sdl::Renderer& renderer, Settings& settings)
 {
-    // spaces between basic elements, in pixels
-    auto space_width = m_font->get_space_width();
-    auto line_height = m_font->get_line_skip();
+    trace::Scope scope("View::render");
+    if (!m_glyph_atlas) {
+        m_glyph_atlas = std::make_shared<sdl::GlyphAtlas>(renderer, m_font);
+    }
+    add_prefetched_glyphs(renderer);
+    sync_line_cache(settings);
+    if (m_wrap) {
+        update_rows();
+        measure_rows();
+    }
+    update_document_size();
+    m_shown_progress = get_progress();
+    m_dirty = false;
+    if (viewport_size.w == 0 || viewport_size.h == 0) {
+        return;
+    }
+
+    // the text comes from the frame texture...
+    update_frame(renderer, settings);
+    renderer.put_texture(*m_frame, sdl::Point2d(m_rect.x, m_rect.y));
+
+    // ...with the rest drawn over it, within the view
+    renderer.set_clip_rect(sdl::Rect(m_rect.x, m_rect.y, viewport_size));
+    if (m_document->is_loading()) {
+        queue_loading_indicator(renderer, settings);
+    }
+    if (m_search_prompt_shown) {
+        queue_search_prompt(renderer, settings);
+    }
+    m_glyph_atlas->flush(renderer);
+    renderer.reset_clip_rect();
 
-    // clear the viewport
-    renderer.fill_rect(sdl::Rect(0, 0, viewport_size), settings.background_color);
+    //m_scrollbar.place_to_right_edge(renderer); // sdl::Rect(viewport_size.w - SCROLLBAR_WIDTH, 0, SCROLLBAR_WIDTH, viewport_size.h));
+    m_scrollbar.set_full_range(get_row_count());
+    m_scrollbar.set_marked_range(get_top_row(), max_lines_shown);
+    m_scrollbar.render(renderer, settings);
+    prefetch(settings);
+}
+
+void View::update_frame(sdl::Renderer& renderer, Settings& settings)
+{
+    trace::Scope scope("View::update_frame");
+    auto frame_size = m_frame ? m_frame->get_size() : sdl::Size2d();
+    if (frame_size.w != viewport_size.w || frame_size.h != viewport_size.h) {
+        m_frame = std::make_unique<sdl::Texture>(renderer.make_texture(FRAME_FORMAT, SDL_TEXTUREACCESS_TARGET, viewport_size));
+        m_back_frame = std::make_unique<sdl::Texture>(renderer.make_texture(FRAME_FORMAT, SDL_TEXTUREACCESS_TARGET, viewport_size));
+        m_frame_valid = false;
+    }
+
+    // the previous frame can be reused if only scrolled, in one direction,
+    // by less than the viewport (with wrapping, the rows in between are
+    // those laid out around the view, so they are counted exactly)
+    int64_t row_delta = int64_t(top_line_shown) - m_frame_top_line;
+    if (m_wrap && m_frame_valid) {
+        row_delta = int64_t(get_top_row()) - int64_t(m_rows.get_row(m_frame_top_line) + m_frame_top_line_row);
+    }
+    int64_t x_delta = int64_t(scroll_x) - m_frame_scroll_x;
+    bool can_shift = m_frame_valid && (row_delta == 0 || x_delta == 0)
+        && std::abs(row_delta) < max_lines_shown && std::abs(x_delta) < viewport_size.w;
+    if (can_shift && row_delta == 0 && x_delta == 0) {
+        return;
+    }
+
+    // the new frame is drawn into the back texture (a texture cannot be
+    // copied into itself), then the two are swapped
+    renderer.set_target(m_back_frame.get());
+    int w = viewport_size.w, h = viewport_size.h;
+    m_draw_left = 0;
+    m_draw_right = w;
+    int line_height = m_font->get_line_skip();
+    if (!can_shift) {
+        renderer.fill_rect(sdl::Rect(0, 0, viewport_size), settings.background_color);
+        render_rows(renderer, settings, 0, max_lines_shown);
+    }
+    else if (row_delta != 0) {
 
-    // how many lines we need to really draw
-    auto lines_to_render = std::min(size_t(top_line_shown + max_lines_shown), m_document->size());
+        // move the rows still visible...
+        int shift = int(row_delta) * line_height;
+        int kept = h - std::abs(shift);
+        renderer.put_texture_part(*m_frame, sdl::Rect(0, std::max(-shift, 0), w, kept), sdl::Rect(0, std::max(shift, 0), w, kept));
+
+        // ...draw the rows that came into view (counted from the top of
+        // the view), and clear what is below the last row
+        uint32_t first, last;
+        int strip_top, strip_bottom;
+        if (row_delta > 0) {
+            first = max_lines_shown - row_delta;
+            last = max_lines_shown;
+            strip_top = PADDING_TOP + first * line_height;
+            strip_bottom = h;
+        }
+        else {
+            first = 0;
+            last = -row_delta;
+            strip_top = 0;
+            strip_bottom = PADDING_TOP + last * line_height;
+            int below_lines = PADDING_TOP + max_lines_shown * line_height;
+            renderer.fill_rect(sdl::Rect(0, below_lines, w, std::max(h - below_lines, 0)), settings.background_color);
+        }
+        renderer.fill_rect(sdl::Rect(0, strip_top, w, strip_bottom - strip_top), settings.background_color);
+        render_rows(renderer, settings, first, last);
+    }
+    else {
+
+        // move the columns still visible, and draw just the strip that came into view
+        int shift = int(x_delta);
+        int kept = w - std::abs(shift);
+        renderer.put_texture_part(*m_frame, sdl::Rect(std::max(-shift, 0), 0, kept, h), sdl::Rect(std::max(shift, 0), 0, kept, h));
+        auto strip = (shift > 0) ? sdl::Rect(kept, 0, shift, h) : sdl::Rect(0, 0, -shift, h);
+        renderer.set_clip_rect(strip);
+        renderer.fill_rect(strip, settings.background_color);
+        m_draw_left = strip.x;
+        m_draw_right = strip.x + strip.w;
+        render_rows(renderer, settings, 0, max_lines_shown);
+        m_glyph_atlas->flush(renderer);
+        renderer.reset_clip_rect();
+    }
+    m_glyph_atlas->flush(renderer);
+    renderer.set_target(nullptr);
+
+    std::swap(m_frame, m_back_frame);
+    m_frame_valid = true;
+    m_frame_top_line = top_line_shown;
+    m_frame_top_line_row = top_line_row;
+    m_frame_scroll_x = scroll_x;
+}
+
+void View::render_rows(sdl::Renderer& renderer, Settings& settings, uint32_t first, uint32_t last)
+{
+    if (m_wrap) {
+        render_wrapped_rows(renderer, settings, first, last);
+    }
+    else {
+        render_lines(renderer, settings, top_line_shown + first, top_line_shown + last);
+    }
+}
+
+void View::render_lines(sdl::Renderer& renderer, Settings& settings, uint32_t first, uint32_t last)
+{
+    trace::Scope scope("View::render_lines");
+    auto line_height = m_font->get_line_skip();
+    last = std::min<size_t>(last, m_document->size());
 
     // for each line...
-    auto topleft = sdl::Point2d(-scroll_x, PADDING_TOP);
-    for (auto i = top_line_shown; i < lines_to_render; i++) {
+    auto topleft = sdl::Point2d(-scroll_x, PADDING_TOP + (first - top_line_shown) * line_height);
+    for (auto i = first; i < last; i++) {
 
-        // render all pieces on the line (for long lines, some may not be visible)
-        auto& line = m_document->get_line(i);
-        for (auto& piece : line.pieces) {
-            if (!piece.empty()) {
-                auto piece_texture = m_font->render_to_texture(renderer, piece.get_text(), settings.text_color);
-                renderer.put_texture(piece_texture, sdl::Rect(topleft, piece_texture.get_size()));
-                topleft.x += piece_texture.get_size().w + space_width;
-            }
+        // draw the line from a cached texture, or queue its glyphs (in
+        // the colors of the syntax, if highlighted)
+        auto line = m_document->get_line(i);
+        if (m_search) {
+            draw_match_highlights(renderer, settings, i, line, topleft);
+        }
+        auto runs = get_highlight_runs(settings, i);
+        if (uses_line_textures(settings, i)) {
+            draw_line_texture(renderer, settings, i, line, topleft);
+        }
+        else {
+            queue_line_glyphs(renderer, settings, i, line, topleft, runs);
         }
 
         // move to the new line
-        topleft.x = -scroll_x;
         topleft.y += line_height;
     }
+}
 
-    //m_scrollbar.place_to_right_edge(renderer); // sdl::Rect(viewport_size.w - SCROLLBAR_WIDTH, 0, SCROLLBAR_WIDTH, viewport_size.h));
-    m_scrollbar.set_full_range(m_document->size());
-    m_scrollbar.set_marked_range(top_line_shown, max_lines_shown);
-    m_scrollbar.render(renderer, settings);
+void View::render_wrapped_rows(sdl::Renderer& renderer, Settings& settings, uint32_t first, uint32_t last)
+{
+    trace::Scope scope("View::render_wrapped_rows");
+    auto line_height = m_font->get_line_skip();
+    auto line_count = m_document->size();
+
+    // for each line from the top one, as long as its rows reach the range...
+    int64_t row = -int64_t(top_line_row);      // of the line start, from the top of the view
+    for (auto i = top_line_shown; i < line_count && row < last; i++) {
+        auto rows = m_rows.get_rows(i);
+        if (row + rows <= first) {
+            row += rows;
+            continue;
+        }
+        auto line = m_document->get_line(i);
+        auto& layout = get_wrap_layout(i, line);
+        auto runs = get_highlight_runs(settings, i);
+        std::vector<SearchMatch> matches;
+        uint64_t line_start = 0u;
+        if (m_search) {
+            line_start = m_document->get_line_offset(i);
+            matches = m_search->get_matches(line_start, line_start + line.get_text().size() + 1);
+        }
+
+        // ...queue the segments of its rows in the range
+        for (uint32_t j = 0; j < layout.get_row_count(); j++) {
+            if (row + j < first || row + j >= last) {
+                continue;
+            }
+            auto topleft = sdl::Point2d(0, PADDING_TOP + (row + j) * line_height);
+            auto begin = layout.segments.begin() + layout.row_starts[j];
+            auto end = (j + 1 < layout.get_row_count()) ? layout.segments.begin() + layout.row_starts[j + 1] : layout.segments.end();
+            if (!matches.empty()) {
+                draw_unit_highlights(renderer, settings, matches, line_start, line, std::vector<Segment>(begin, end), topleft);
+            }
+            for (auto segment = begin; segment != end; segment++) {
+                queue_styled_text(renderer, settings, sdl::Point2d(segment->x, topleft.y),
+                    line.get_text().substr(segment->offset, segment->length), segment->offset, runs);
+            }
+        }
+        row += layout.get_row_count();
+    }
+}
+
+View::WrapLayout const& View::get_wrap_layout(uint32_t number, Line& line)
+{
+    auto it = m_wrap_layouts.find(number);
+    if (it != m_wrap_layouts.end()) {
+        return it->second;
+    }
+    if (m_wrap_layouts.size() >= MAX_LINE_LAYOUTS) {
+        m_wrap_layouts.clear();
+    }
+
+    // the pieces are placed as queue_line_glyphs() places them; a piece
+    // that does not fit goes to the next row, and a piece that does not
+    // fit even there is cut where the row is full
+    WrapLayout layout;
+    layout.row_starts.push_back(0u);
+    int32_t width = std::max<int32_t>(m_wrap_width, 1);
+    auto space_width = m_font->get_space_width();
+    int32_t x = 0;
+    for (auto& piece : line.pieces) {
+        if (piece.empty()) {
+            continue;
+        }
+        auto text = piece.get_text();
+        auto offset = line.get_offset(piece);
+        while (!text.empty()) {
+            int32_t fitted_width = 0;
+            auto length = fit_text(text, width - x, fitted_width);
+            if (length < text.size() && x > 0) {
+                layout.row_starts.push_back(layout.segments.size());
+                x = 0;
+                continue;
+            }
+
+            // (at least a codepoint goes on each row, even if the view is narrower)
+            if (length == 0) {
+                length = 1;
+                while (length < text.size() && (text[length] & 0xc0) == 0x80) {
+                    length++;
+                }
+                fitted_width = m_font->calc_text_width(text.substr(0, length));
+            }
+            layout.segments.push_back(Segment { uint32_t(offset), uint32_t(length), x });
+            text.remove_prefix(length);
+            offset += length;
+            x += fitted_width;
+            if (!text.empty()) {
+                layout.row_starts.push_back(layout.segments.size());
+                x = 0;
+            }
+        }
+        x += space_width;
+    }
+    return m_wrap_layouts.emplace(number, std::move(layout)).first->second;
+}
+
+size_t View::fit_text(std::string_view text, int32_t available, int32_t& fitted_width)
+{
+    auto is_continuation = [&](size_t i) { return i < text.size() && (text[i] & 0xc0) == 0x80; };
+    auto measure = [&](size_t length) { return int32_t(m_font->calc_text_width(text.substr(0, length))); };
+    fitted_width = 0;
+    if (available <= 0) {
+        return 0;
+    }
+
+    // the first guess takes a byte per space width (which is exact for
+    // ASCII in a monospace font), then the next codepoint is tried, and
+    // from there the length is doubled until it does not fit, so that
+    // only about a row of a long piece is measured...
+    auto snap = [&](size_t i) {
+        while (is_continuation(i)) {
+            i++;
+        }
+        return std::min(i, text.size());
+    };
+    size_t low = 0;
+    size_t high = snap(std::max<size_t>(available / std::max<uint32_t>(m_font->get_space_width(), 1u), 1u));
+    for (bool first = true; ; first = false) {
+        auto high_width = measure(high);
+        if (high_width > available) {
+            break;
+        }
+        low = high;
+        fitted_width = high_width;
+        if (high == text.size()) {
+            return high;
+        }
+        high = first ? snap(high + 1) : snap(high * 2);
+    }
+
+    // ...and the longest prefix that fits (of whole codepoints) is bisected
+    while (true) {
+        auto middle = (low + high) / 2;
+        while (middle > low && is_continuation(middle)) {
+            middle--;
+        }
+        if (middle == low) {
+            middle = (low + high) / 2 + 1;
+            while (middle < high && is_continuation(middle)) {
+                middle++;
+            }
+            if (middle >= high) {
+                break;
+            }
+        }
+        auto middle_width = measure(middle);
+        if (middle_width <= available) {
+            low = middle;
+            fitted_width = middle_width;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+void View::invalidate_frame()
+{
+    m_frame_valid = false;
+    m_prefetch_valid = false;
+    invalidate();
+}
+
+void View::queue_line_glyphs(sdl::Renderer& renderer, Settings& settings, uint32_t number, Line& line, sdl::Point2d topleft,
+    std::vector<HighlightRun> const* runs)
+{
+    // long lines are laid out once, and only the segments in view are queued
+    if (line.get_text().size() > MAX_CACHED_LINE_LENGTH) {
+        auto& segments = get_line_layout(number, line);
+        auto [first, last] = find_visible_segments(segments, topleft.x);
+        for (auto i = first; i < last; i++) {
+            auto& segment = segments[i];
+            queue_styled_text(renderer, settings, sdl::Point2d(topleft.x + segment.x, topleft.y),
+                line.get_text().substr(segment.offset, segment.length), segment.offset, runs);
+        }
+        return;
+    }
+
+    // queue all pieces on the line
+    auto space_width = m_font->get_space_width();
+    for (auto& piece : line.pieces) {
+        if (!piece.empty()) {
+            topleft.x += queue_styled_text(renderer, settings, topleft, piece.get_text(), line.get_offset(piece), runs);
+            topleft.x += space_width;
+        }
+    }
+}
+
+int32_t View::queue_styled_text(sdl::Renderer& renderer, Settings& settings, sdl::Point2d topleft, std::string_view text,
+    uint32_t offset, std::vector<HighlightRun> const* runs)
+{
+    if (!runs || runs->empty()) {
+        return m_glyph_atlas->add_text(renderer, topleft, text, settings.text_color);
+    }
+    auto style_color = [&](HighlightStyle style) {
+        switch (style) {
+            case HighlightStyle::Timestamp: return settings.timestamp_color;
+            case HighlightStyle::Error:     return settings.error_color;
+            case HighlightStyle::Warning:   return settings.warning_color;
+            case HighlightStyle::Info:      return settings.info_color;
+            case HighlightStyle::Debug:     return settings.debug_color;
+            case HighlightStyle::Key:       return settings.key_color;
+            case HighlightStyle::String:    return settings.string_color;
+            case HighlightStyle::Number:    return settings.number_color;
+            case HighlightStyle::Keyword:   return settings.keyword_color;
+            case HighlightStyle::Comment:   return settings.comment_color;
+            default:                        return settings.text_color;
+        }
+    };
+
+    // the text (at `offset` in the line) is cut where the runs over it
+    // begin and end, the parts between them are in the text color
+    auto end = offset + uint32_t(text.size());
+    auto run = std::partition_point(runs->begin(), runs->end(),
+        [&](HighlightRun const& run) { return run.offset + run.length <= offset; });
+    auto x = topleft.x;
+    auto queue_part = [&](uint32_t part_end, sdl::Color color) {
+        x += m_glyph_atlas->add_text(renderer, sdl::Point2d(x, topleft.y), text.substr(0, part_end - offset), color);
+        text.remove_prefix(part_end - offset);
+        offset = part_end;
+    };
+    while (offset < end) {
+        if (run == runs->end() || run->offset >= end) {
+            queue_part(end, settings.text_color);
+        }
+        else if (run->offset > offset) {
+            queue_part(run->offset, settings.text_color);
+        }
+        else {
+            queue_part(std::min(run->offset + run->length, end), style_color(run->style));
+            run++;
+        }
+    }
+    return x - topleft.x;
+}
+
+std::vector<HighlightRun> const* View::get_highlight_runs(Settings& settings, uint32_t number)
+{
+    if (!settings.use_highlighting) {
+        return nullptr;
+    }
+    trace::Scope scope("View::get_highlight_runs");
+    return &m_highlights->get_runs(number);
+}
+
+std::vector<View::Segment> const& View::get_line_layout(uint32_t number, Line& line)
+{
+    auto it = m_line_layouts.find(number);
+    if (it != m_line_layouts.end()) {
+        return it->second;
+    }
+    if (m_line_layouts.size() >= MAX_LINE_LAYOUTS) {
+        m_line_layouts.clear();
+    }
+
+    // the pieces are cut into segments (at codepoint boundaries), placed
+    // as queue_line_glyphs() places the whole pieces
+    std::vector<Segment> segments;
+    auto space_width = m_font->get_space_width();
+    int32_t x = 0;
+    for (auto& piece : line.pieces) {
+        auto text = piece.get_text();
+        auto piece_offset = line.get_offset(piece);
+        for (size_t start = 0; start < text.size(); ) {
+            auto end = std::min(start + LAYOUT_SEGMENT_SIZE, text.size());
+            while (end < text.size() && (text[end] & 0xc0) == 0x80) {
+                end++;
+            }
+            segments.push_back(Segment { uint32_t(piece_offset + start), uint32_t(end - start), x });
+            x += m_font->calc_text_width(text.substr(start, end - start));
+            start = end;
+        }
+        x += space_width;
+    }
+    segments.push_back(Segment { uint32_t(line.get_text().size()), 0u, x });
+    return m_line_layouts.emplace(number, std::move(segments)).first->second;
+}
+
+std::pair<size_t, size_t> View::find_visible_segments(std::vector<Segment> const& segments, int32_t line_x)
+{
+    // the first segment that ends past the left edge...
+    auto left = m_draw_left - line_x, right = m_draw_right - line_x;
+    auto by_x = [](int32_t x, Segment const& segment) { return x < segment.x; };
+    auto first = std::upper_bound(segments.begin(), segments.end() - 1, left, by_x) - segments.begin();
+    first = std::max<ptrdiff_t>(first - 1, 0);
+
+    // ...up to the first one that starts past the right edge
+    auto last = std::lower_bound(segments.begin() + first, segments.end() - 1, right,
+        [](Segment const& segment, int32_t x) { return segment.x < x; }) - segments.begin();
+    return { size_t(first), size_t(last) };
+}
+
+void View::draw_line_texture(sdl::Renderer& renderer, Settings& settings, uint32_t number, Line& line, sdl::Point2d topleft)
+{
+    if (line.empty()) {
+        return;
+    }
+
+    // a line not cached may have been rasterized ahead, then it only has to be uploaded
+    auto key = LineTextureCache::Key(number, *m_font, settings.text_color);
+    auto texture = m_line_cache.find(key);
+    if (!texture) {
+        auto prefetched = m_rasterizer->take(
+            Rasterizer::Key(Rasterizer::Kind::Line, m_document.get(), number, m_font->get_size(), settings.text_color));
+        if (prefetched) {
+            texture = &m_line_cache.insert(key, renderer.texture_from_surface(prefetched->surface));
+        }
+        else {
+            texture = &m_line_cache.insert(key, m_font->render_to_texture(renderer, join_line_pieces(line), settings.text_color));
+        }
+    }
+    renderer.put_texture(*texture, topleft);
+}
+
+bool View::uses_line_textures(Settings& settings, uint32_t number)
+{
+    return !settings.use_glyph_atlas && !settings.use_highlighting && !m_wrap
+        && m_document->get_line_length(number) <= MAX_CACHED_LINE_LENGTH;
+}
+
+void View::prefetch(Settings& settings)
+{
+    // the speed is smoothed, so that it holds between the repeats of a held key
+    int64_t delta = int64_t(top_line_shown) - m_prefetch_top_line;
+    m_prefetch_top_line = top_line_shown;
+    m_scroll_speed = (m_scroll_speed * 3 + std::abs(delta)) / 4;
+    if (delta != 0) {
+        m_scroll_direction = delta > 0 ? 1 : -1;
+    }
+    else if (m_prefetch_valid) {
+        return;
+    }
+    m_prefetch_valid = true;
+    trace::Scope scope("View::prefetch");
+
+    // whole lines for the line textures, otherwise the glyphs on them (for
+    // the atlas, which is there from the first render on)
+    bool whole_lines = !settings.use_glyph_atlas && !settings.use_highlighting && !m_wrap;
+    if (!whole_lines && !m_glyph_atlas) {
+        return;
+    }
+
+    // the lines from the view on, in the direction of the scroll (nearest
+    // first), as far as they are known (the workers read them, so the
+    // document is not made to index any further here)
+    auto lookahead = std::min<uint64_t>(max_lines_shown + uint64_t(m_scroll_speed * PREFETCH_FRAMES),
+        uint64_t(max_lines_shown) * MAX_PREFETCH_PAGES);
+    auto line_count = m_shown_progress.line_count;
+    Rasterizer::Request request { this, m_document, {}, whole_lines, MAX_CACHED_LINE_LENGTH, PREFETCH_SCAN_LENGTH,
+        m_font->get_size(), settings.text_color };
+    auto add_line = [&](uint32_t number) {
+        if (!whole_lines || !m_line_cache.contains(LineTextureCache::Key(number, *m_font, settings.text_color))) {
+            request.lines.push_back(number);
+        }
+    };
+    if (m_scroll_direction > 0) {
+        for (uint64_t i = top_line_shown; i < line_count && i < top_line_shown + max_lines_shown + lookahead; i++) {
+            add_line(i);
+        }
+    }
+    else {
+        for (int64_t i = int64_t(top_line_shown) - 1; i >= 0 && i >= int64_t(top_line_shown) - int64_t(lookahead); i--) {
+            add_line(i);
+        }
+    }
+    m_rasterizer->prefetch(std::move(request));
+}
+
+void View::add_prefetched_glyphs(sdl::Renderer& renderer)
+{
+    for (auto& [key, result] : m_rasterizer->take_glyphs()) {
+        m_glyph_atlas->add_glyph(renderer, key.number, key.font_size, result.surface, result.advance);
+    }
+}
+
+void View::sync_line_cache(Settings& settings)
+{
+    // the cached lines are of no use once the color changes
+    auto& color = settings.text_color;
+    if (color.r != m_line_cache_color.r || color.g != m_line_cache_color.g
+        || color.b != m_line_cache_color.b || color.a != m_line_cache_color.a) {
+        m_line_cache.clear();
+        m_line_cache_color = color;
+        m_frame_valid = false;
+    }
+    if (m_line_cache.get_budget() != settings.line_cache_budget) {
+        m_line_cache.set_budget(settings.line_cache_budget);
+    }
+    if (m_highlighting_shown != settings.use_highlighting) {
+        m_highlighting_shown = settings.use_highlighting;
+        m_frame_valid = false;
+    }
+}
+
+void View::set_font(std::shared_ptr<sdl::Font> font)
+{
+    invalidate_frame();
+    m_font = font;
+    m_glyph_atlas.reset();
+    m_line_cache.clear();
+    m_line_layouts.clear();
+    m_wrap_layouts.clear();
+    m_rows.clear();
+    m_bounds = std::make_shared<DocumentBounds>(m_document, *m_font);
+    m_rasterizer = std::make_shared<Rasterizer>(*m_font);
+    update_document_size();
+    max_lines_shown = viewport_size.h / m_font->get_line_skip();
+}
+
+void View::queue_loading_indicator(sdl::Renderer& renderer, Settings& settings)
+{
+    // a progress bar along the bottom edge...
+    auto progress = m_document->get_load_progress();
+    auto bar_top = m_rect.y + int(viewport_size.h - LOADING_BAR_HEIGHT);
+    renderer.fill_rect(sdl::Rect(m_rect.x, bar_top, viewport_size.w, LOADING_BAR_HEIGHT), settings.widget_background_color);
+    renderer.fill_rect(sdl::Rect(m_rect.x, bar_top, uint32_t(viewport_size.w * progress), LOADING_BAR_HEIGHT),
+        settings.widget_indicator_color);
+
+    // ...with the percentage above it
+    auto text = "loading " + std::to_string(int(progress * 100)) + "%";
+    auto text_top = bar_top - int(m_font->get_line_skip());
+    m_glyph_atlas->add_text(renderer, sdl::Point2d(m_rect.x, text_top), text, settings.widget_text_color);
+}
+
+void View::draw_match_highlights(sdl::Renderer& renderer, Settings& settings, uint32_t number, Line& line, sdl::Point2d topleft)
+{
+    auto line_start = m_document->get_line_offset(number);
+    auto matches = m_search->get_matches(line_start, line_start + line.get_text().size() + 1);
+    if (matches.empty()) {
+        return;
+    }
+
+    // the text is laid out as in queue_line_glyphs(): by pieces, or for
+    // long lines, by the visible segments; each match is highlighted in
+    // those it overlaps
+    std::vector<Segment> units;
+    if (line.get_text().size() > MAX_CACHED_LINE_LENGTH) {
+        auto& segments = get_line_layout(number, line);
+        auto [first, last] = find_visible_segments(segments, topleft.x);
+        units.assign(segments.begin() + first, segments.begin() + last);
+    }
+    else {
+        auto space_width = m_font->get_space_width();
+        int32_t x = 0;
+        for (auto& piece : line.pieces) {
+            auto text = piece.get_text();
+            units.push_back(Segment { uint32_t(line.get_offset(piece)), uint32_t(text.size()), x });
+            x += m_font->calc_text_width(text) + space_width;
+        }
+    }
+
+    draw_unit_highlights(renderer, settings, matches, line_start, line, units, topleft);
+}
+
+void View::draw_unit_highlights(sdl::Renderer& renderer, Settings& settings, std::vector<SearchMatch> const& matches,
+    uint64_t line_start, Line& line, std::vector<Segment> const& units, sdl::Point2d topleft)
+{
+    auto line_height = m_font->get_line_skip();
+    for (auto& unit : units) {
+        auto text = line.get_text().substr(unit.offset, unit.length);
+        auto unit_end = unit.offset + unit.length;
+        for (auto& match : matches) {
+            auto match_start = std::max<size_t>(match.offset - line_start, unit.offset);
+            auto match_end = std::min<size_t>(match.offset - line_start + match.length, unit_end);
+            if (match_start >= match_end) {
+                continue;
+            }
+            auto x = topleft.x + unit.x + m_font->calc_text_width(text.substr(0, match_start - unit.offset));
+            auto w = m_font->calc_text_width(text.substr(match_start - unit.offset, match_end - match_start));
+            bool is_current = m_current_match && m_current_match->offset == match.offset;
+            renderer.fill_rect(sdl::Rect(x, topleft.y, w, line_height),
+                is_current ? settings.search_current_color : settings.search_match_color);
+        }
+    }
+}
+
+void View::queue_search_prompt(sdl::Renderer& renderer, Settings& settings)
+{
+    std::string text = (m_search_is_regex ? "find (regex): " : "find: ") + m_search_query;
+    if (!m_search_error.empty()) {
+        text += "  (" + m_search_error + ")";
+    }
+    else if (m_search && !m_search_query.empty()) {
+        text += "  (" + std::to_string(m_search->get_match_count()) + " matches"
+            + (m_search->is_done() ? ")" : ", searching...)");
+    }
+
+    // a strip along the top edge
+    renderer.fill_rect(sdl::Rect(m_rect.x, m_rect.y, viewport_size.w, m_font->get_line_skip()), settings.widget_background_color);
+    m_glyph_atlas->add_text(renderer, sdl::Point2d(m_rect.x, m_rect.y), text, settings.widget_text_color);
+}
+
+void View::start_search(std::string query, bool is_regex)
+{
+    invalidate_frame();
+    m_search.reset();
+    m_search_due.reset();
+    m_current_match.reset();
+    m_search_query = query;
+    m_search_is_regex = is_regex;
+    m_search_prompt_shown = true;
+    m_search_error.clear();
+    try {
+        m_search = std::make_unique<Search>(m_document, query, is_regex);
+    }
+    catch (std::regex_error& e) {
+        m_search_error = "invalid expression";
+    }
+}
+
+void View::edit_search(std::string query, bool is_regex)
+{
+    invalidate_frame();
+    m_search.reset();
+    m_current_match.reset();
+    m_search_query = query;
+    m_search_is_regex = is_regex;
+    m_search_prompt_shown = true;
+    m_search_error.clear();
+    m_search_due = std::chrono::steady_clock::now() + std::chrono::milliseconds(SEARCH_DELAY_MS);
+}
+
+void View::clear_search()
+{
+    invalidate_frame();
+    m_search.reset();
+    m_search_due.reset();
+    m_current_match.reset();
+    m_search_query.clear();
+    m_search_prompt_shown = false;
+    m_search_error.clear();
+}
+
+bool View::find_next_match()
+{
+    if (m_search_due) {
+        start_search(m_search_query, m_search_is_regex);
+    }
+    if (!m_search) {
+        return false;
+    }
+    auto from = m_current_match ? m_current_match->offset + 1 : m_document->get_line_offset(top_line_shown);
+    auto match = m_search->find_next(from);
+    if (!match) {
+        return false;
+    }
+    scroll_to_match(*match);
+    return true;
+}
+
+bool View::find_previous_match()
+{
+    if (m_search_due) {
+        start_search(m_search_query, m_search_is_regex);
+    }
+    if (!m_search) {
+        return false;
+    }
+    auto from = m_current_match ? m_current_match->offset : m_document->get_line_offset(top_line_shown);
+    auto match = m_search->find_previous(from);
+    if (!match) {
+        return false;
+    }
+    scroll_to_match(*match);
+    return true;
+}
+
+void View::scroll_to_match(SearchMatch const& match)
+{
+    invalidate_frame();
+    m_current_match = match;
+
+    // if the line is not visible, bring it to the middle of the view
+    auto line = m_document->get_line_at_offset(match.offset);
+    auto top_row = get_top_row();
+    uint64_t row = m_wrap ? m_rows.get_row(line) : line;
+    if (row < top_row || row >= top_row + max_lines_shown) {
+
+        // (with wrapping, the lines above are laid out first, so that
+        // the rows up to the middle are counted exactly)
+        uint64_t rows_above = 0u;
+        for (auto i = line; m_wrap && i > 0 && rows_above < max_lines_shown / 2; ) {
+            rows_above += measure_line_rows(--i);
+        }
+        row = m_wrap ? m_rows.get_row(line) : line;
+        set_top_row((row > max_lines_shown / 2) ? row - max_lines_shown / 2 : 0);
+    }
+}
+
+void View::update_document_size()
+{
+    // the width grows as the lines are measured in the background
+    if (m_wrap) {
+        document_size = sdl::Size2d(viewport_size.w, get_row_count() * m_font->get_line_skip());
+        return;
+    }
+    document_size = sdl::Size2d(m_bounds->get_max_width(), m_document->size() * m_font->get_line_skip());
+}
+
+void View::set_wrap(bool wrap)
+{
+    if (wrap == m_wrap) {
+        return;
+    }
+    m_wrap = wrap;
+    m_rows.clear();
+    m_wrap_layouts.clear();
+    top_line_row = 0;
+    scroll_x = 0;
+    invalidate_frame();
+    update_document_size();
+}
+
+uint64_t View::get_top_row()
+{
+    update_rows();
+    return m_wrap ? m_rows.get_row(top_line_shown) + top_line_row : top_line_shown;
+}
+
+uint64_t View::get_row_count()
+{
+    update_rows();
+    return m_wrap ? m_rows.get_row_count() : m_document->size();
+}
+
+void View::set_top_row(uint64_t row)
+{
+    update_rows();
+    if (m_wrap) {
+        std::tie(top_line_shown, top_line_row) = m_rows.find_line(row);
+    }
+    else {
+        top_line_shown = row;
+    }
+}
+
+void View::update_rows()
+{
+    if (!m_wrap) {
+        return;
+    }
+
+    // the rows depend on the width, and a reopened file may be shorter
+    auto line_count = m_document->size();
+    if (m_wrap_width != viewport_size.w || m_rows.size() > line_count) {
+        m_rows.clear();
+        m_wrap_layouts.clear();
+        m_wrap_width = viewport_size.w;
+    }
+    if (m_rows.size() == line_count) {
+        return;
+    }
+
+    // the lines not in the index yet are estimated from their lengths,
+    // as if every byte were as wide as a space
+    trace::Scope scope("View::update_rows");
+    auto lengths = m_document->get_line_lengths(m_rows.size(), line_count);
+    uint64_t space_width = m_font->get_space_width();
+    uint64_t width = std::max<uint32_t>(m_wrap_width, 1u);
+    for (auto& length : lengths) {
+        length = std::max<uint64_t>((length * space_width + width - 1) / width, 1u);
+    }
+    if (m_rows.empty()) {
+        m_rows.assign(lengths);
+    }
+    else {
+        m_rows.append(lengths);
+    }
+    if (top_line_shown >= m_rows.size()) {
+        top_line_shown = m_rows.empty() ? 0 : m_rows.size() - 1;
+        top_line_row = 0;
+    }
+}
+
+uint32_t View::measure_line_rows(size_t number)
+{
+    if (!m_rows.is_measured(number)) {
+        auto line = m_document->get_line(number);
+        m_rows.set_rows(number, get_wrap_layout(number, line).get_row_count());
+    }
+    return m_rows.get_rows(number);
+}
+
+void View::measure_rows()
+{
+    trace::Scope scope("View::measure_rows");
+    if (m_rows.empty() || viewport_size.w == 0) {
+        return;
+    }
+
+    // the lines of a view's worth above the top and below the bottom
+    // are laid out too, so that scrolling by up to a page (and shifting
+    // the last frame) counts their real rows
+    uint64_t rows = 0u;
+    for (auto i = top_line_shown; i > 0 && rows < max_lines_shown; ) {
+        rows += measure_line_rows(--i);
+    }
+    rows = 0u;
+    for (size_t i = top_line_shown; i < m_rows.size() && rows < top_line_row + 2 * max_lines_shown; i++) {
+        rows += measure_line_rows(i);
+    }
+    top_line_row = std::min(top_line_row, m_rows.get_rows(top_line_shown) - 1);
 }
 
 void View::scroll_line_up()
 {
-    if (top_line_shown > 0) {
-        top_line_shown--;
+    if (get_top_row() > 0) {
+        set_top_row(get_top_row() - 1);
+        invalidate();
     }
 }
 
 void View::scroll_line_down()
 {
-    if (top_line_shown + max_lines_shown < m_document->size()) {
-        top_line_shown++;
+    if (get_top_row() + max_lines_shown < get_row_count()) {
+        set_top_row(get_top_row() + 1);
+        invalidate();
     }
 }
 
@@ -64,54 +946,223 @@ void View::scroll_block_left()
 {
     if (scroll_x > 0) {
         scroll_x -= HORIZONTAL_SCROLL_AMOUNT;
+        invalidate();
     }
 }
 
 void View::scroll_block_right()
 {
-    if (scroll_x < document_size.w - viewport_size.w) {
+    update_document_size();
+    if (m_wrap) {
+        return;
+    }
+    if (scroll_x + viewport_size.w < document_size.w) {
         scroll_x += HORIZONTAL_SCROLL_AMOUNT;
+        invalidate();
+    }
+}
+
+void View::scroll_lines(int delta)
+{
+    // (with wrapping, by rows)
+    int64_t row_count = get_row_count();
+    int64_t top_row = get_top_row();
+    int64_t last_top = std::max<int64_t>(row_count - max_lines_shown, 0);
+    auto new_top = std::clamp<int64_t>(top_row + delta, 0, std::max<int64_t>(last_top, top_row));
+    if (new_top != top_row) {
+        set_top_row(new_top);
+        invalidate();
+    }
+}
+
+void View::scroll_blocks(int delta)
+{
+    update_document_size();
+    if (m_wrap) {
+        return;
+    }
+    // (as with scroll_block_right(), the last block may go past the edge)
+    int64_t overflow = std::max<int64_t>(int64_t(document_size.w) - viewport_size.w, 0);
+    int64_t last_x = (overflow + HORIZONTAL_SCROLL_AMOUNT - 1) / HORIZONTAL_SCROLL_AMOUNT * HORIZONTAL_SCROLL_AMOUNT;
+    auto new_x = std::clamp<int64_t>(int64_t(scroll_x) + int64_t(delta) * HORIZONTAL_SCROLL_AMOUNT, 0,
+        std::max<int64_t>(last_x, scroll_x));
+    if (new_x != scroll_x) {
+        scroll_x = new_x;
+        invalidate();
     }
 }
 
 void View::update_viewport_size(sdl::Renderer& renderer)
 {
-    viewport_size = renderer.get_output_size();
-    max_lines_shown = viewport_size.h / m_font->get_line_skip();
-    scroll_x = 0;
+    set_rect(sdl::Rect(0, 0, renderer.get_output_size()));
 }
 
 void View::scroll_to_indicator(uint32_t new_indicator_position)
 {
-    top_line_shown = new_indicator_position * m_document->size() / viewport_size.h;
+    invalidate();
+    auto row_count = get_row_count();
+    uint64_t row = viewport_size.h ? uint64_t(new_indicator_position) * row_count / viewport_size.h : 0u;
 
     // don't go past the file end
-    if (top_line_shown + max_lines_shown > m_document->size()) {
-        top_line_shown = m_document->size() - max_lines_shown;
+    if (row + max_lines_shown > row_count) {
+        row = (row_count > max_lines_shown) ? row_count - max_lines_shown : 0;
     }
+    set_top_row(row);
 }
 
-sdl::Size2d calc_document_bounds(Document& document, sdl::Font& font)
+void View::scroll_to_end()
 {
-    auto space_width = font.get_space_width();
+    invalidate();
+    update_rows();
 
-    auto document_bounds = sdl::Size2d(0, 0);
-    for (auto i = 0u; i < document.size(); i++) {
-        auto& line = document.get_line(i);
+    // (with wrapping, the last lines are laid out first, so that the view
+    // ends exactly at the last row and stays pinned there)
+    uint64_t rows = 0u;
+    for (auto i = m_wrap ? m_rows.size() : 0; i > 0 && rows < max_lines_shown && viewport_size.w > 0; ) {
+        rows += measure_line_rows(--i);
+    }
+    auto row_count = get_row_count();
+    set_top_row((row_count > max_lines_shown) ? row_count - max_lines_shown : 0);
+}
 
-        // count the sizes of all pieces on the line
-        auto line_bounds = sdl::Size2d(0, 0);
-        for (auto& piece : line.pieces) {
-            auto piece_size = font.calc_rendered_size(piece.get_text());
-            line_bounds.w += piece_size.w;
-            line_bounds.h = std::max(line_bounds.h, piece_size.h);
+bool View::is_scrolled_to_end()
+{
+    return get_top_row() + max_lines_shown >= get_row_count();
+}
+
+bool View::refresh_document(std::vector<View*> const& views)
+{
+    auto& document = views.front()->m_document;
+    auto& bounds = views.front()->m_bounds;
+    std::vector<bool> pinned;
+    for (auto view : views) {
+        assert(view->m_document == document && view->m_bounds == bounds);
+        pinned.push_back(view->is_scrolled_to_end());
+    }
+    auto old_line_count = document->size();
+    auto last_line = old_line_count > 0 ? old_line_count - 1 : 0;
+
+    // the workers must not hold any text while the document changes (a
+    // reopened file is unmapped); then the last line is measured again,
+    // as it may have been partial, and the searches go on over the bytes
+    // appended (unless they are started anew, see take_document_change()).
+    // The lines rasterized ahead are dropped, as any of them may have changed.
+    bounds->pause();
+    for (auto view : views) {
+        if (view->m_search) {
+            view->m_search->pause();
         }
+        view->m_rasterizer->forget(document.get());
+    }
+    auto change = document->refresh();
+    bounds->resume(change == Document::Change::Reopened ? 0 : last_line);
+    if (change != Document::Change::Reopened) {
+        for (auto view : views) {
+            if (view->m_search) {
+                view->m_search->extend();
+                view->m_search->resume();
+            }
+        }
+    }
+    if (change == Document::Change::None) {
+        return false;
+    }
+    for (size_t i = 0; i < views.size(); i++) {
+        views[i]->take_document_change(change, last_line, pinned[i]);
+    }
+    return true;
+}
+
+void View::take_document_change(Document::Change change, size_t last_line, bool pinned)
+{
+    if (change == Document::Change::Reopened) {
+        m_line_cache.clear();
+        m_line_layouts.clear();
+        m_wrap_layouts.clear();
+        m_rows.clear();
+        m_highlights->clear();
+        top_line_shown = std::min<size_t>(top_line_shown, m_document->size());
+        top_line_row = 0;
+
+        // the old matches point to the old file
+        if (m_search) {
+            start_search(m_search_query, m_search_is_regex);
+        }
+    }
+    else {
 
-        // add the spaces between pieces
-        line_bounds.w += line.pieces.size() * space_width;
+        // the last line may have been partial, so it is rendered again
+        m_line_cache.invalidate_line(last_line);
+        m_line_layouts.erase(last_line);
+        m_wrap_layouts.erase(last_line);
+        m_highlights->invalidate_from(last_line);
+        if (last_line < m_rows.size()) {
+            m_rows.set_rows(last_line, m_rows.get_rows(last_line), false);
+        }
+    }
 
-        document_bounds.w = std::max(document_bounds.w, line_bounds.w);
-        document_bounds.h += line_bounds.h;
+    invalidate_frame();
+    update_document_size();
+    if (pinned) {
+        scroll_to_end();
+    }
+}
+
+View::Progress View::get_progress()
+{
+    Progress progress;
+    progress.line_count = m_document->size();
+    if (m_document->is_loading()) {
+        progress.load_percent = int(m_document->get_load_progress() * 100);
+        progress.is_running = true;
+    }
+    if (m_search) {
+        progress.match_count = m_search->get_match_count();
+        progress.is_running = progress.is_running || !m_search->is_done();
+    }
+    if (m_search_due) {
+        progress.is_running = true;
+    }
+    return progress;
+}
+
+void View::fill_highlights(std::vector<std::shared_ptr<View>> const& views)
+{
+    // once per cache, however many views share it
+    std::vector<HighlightCache*> filled;
+    for (auto& view : views) {
+        auto highlights = view->m_highlights.get();
+        if (std::find(filled.begin(), filled.end(), highlights) == filled.end()) {
+            highlights->fill_checkpoints(std::chrono::steady_clock::now() + std::chrono::milliseconds(HIGHLIGHT_FILL_MS));
+            filled.push_back(highlights);
+        }
+    }
+}
+
+bool View::check_background_work()
+{
+    if (m_search_due && std::chrono::steady_clock::now() >= *m_search_due) {
+        start_search(m_search_query, m_search_is_regex);
+    }
+
+    // the provisional highlights are done again once their checkpoints are
+    // known (see fill_highlights())
+    bool highlighting = m_highlights->is_filling();
+    if (m_highlights->get_generation() != m_highlights_generation) {
+        m_highlights_generation = m_highlights->get_generation();
+        invalidate_frame();
+    }
+
+    auto progress = get_progress();
+    if (!(progress == m_shown_progress)) {
+        invalidate();
+
+        // new matches may be anywhere, new lines only past the old end
+        bool lines_shown_grew = progress.line_count != m_shown_progress.line_count
+            && m_shown_progress.line_count <= top_line_shown + max_lines_shown;
+        if (progress.match_count != m_shown_progress.match_count || lines_shown_grew) {
+            m_frame_valid = false;
+        }
     }
-    return document_bounds;
+    return progress.is_running || highlighting;
 }
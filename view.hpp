@@ -1,39 +1,265 @@
 #pragma once
 
 #include "sdl_wrapper.hpp"
+#include "glyph_atlas.hpp"
+#include "highlighter.hpp"
 #include "document.hpp"
+#include "document_bounds.hpp"
+#include "line_cache.hpp"
+#include "rasterizer.hpp"
+#include "row_index.hpp"
+#include "search.hpp"
 #include "settings.hpp"
 #include "widget.hpp"
+#include <chrono>
 #include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
+/**
+ * A scrollable view of a document, drawn within its rect (with
+ * a scrollbar along the right edge).
+ *
+ * Several views can show the same document (see split()): they share
+ * the document with its line index, the measured bounds, the glyph
+ * atlas and the rasterizer, so that another view costs little more than
+ * its frame textures.
+ */
 class View : public virtual Widget {
 protected:
     std::shared_ptr<Document> m_document;
     std::shared_ptr<sdl::Font> m_font;
+    std::shared_ptr<sdl::GlyphAtlas> m_glyph_atlas;    ///< Created on first render (needs a renderer), unless given.
+    LineTextureCache m_line_cache;
+    sdl::Color m_line_cache_color;      ///< Text color the cached lines were rendered with.
+    std::shared_ptr<DocumentBounds> m_bounds;   ///< Shared by the views of the document with the same font.
+    std::shared_ptr<HighlightCache> m_highlights;   ///< Shared by the views of the document.
+    std::shared_ptr<Rasterizer> m_rasterizer;  ///< Shared by the views with the same font, like the glyph atlas.
+    bool m_highlighting_shown = false;  ///< Whether the last frame was highlighted.
+    uint64_t m_highlights_generation = 0u;  ///< Of the highlights the last frame was drawn with.
     VScrollbar m_scrollbar;
+
+    // the text area of the last frame, kept so that after a scroll,
+    // only the part that came into view has to be drawn
+    std::unique_ptr<sdl::Texture> m_frame;
+    std::unique_ptr<sdl::Texture> m_back_frame;
+    bool m_frame_valid = false;         ///< False if the content changed since.
+    uint32_t m_frame_top_line = 0u;
+    uint32_t m_frame_top_line_row = 0u;
+    uint32_t m_frame_scroll_x = 0u;
+
+    /// Horizontal range being drawn (in viewport pixels); the text outside is skipped.
+    int32_t m_draw_left = 0;
+    int32_t m_draw_right = 0;
+
+    /// A part of a long line, with its position; consecutive segments
+    /// make a prefix sum of the x offsets along the line.
+    class Segment {
+    public:
+        uint32_t offset;    ///< Byte offset from the line start.
+        uint32_t length;
+        int32_t x;          ///< Horizontal offset from the line start, in pixels.
+    };
+
+    /// Layouts of the long lines drawn so far (each ends with a sentinel
+    /// segment at the line end), so that just their visible part is drawn.
+    std::unordered_map<uint32_t, std::vector<Segment>> m_line_layouts;
+
+    /// A line broken into rows of the view width; the segments of each
+    /// row are placed from the row start.
+    class WrapLayout {
+    public:
+        std::vector<Segment> segments;
+        std::vector<uint32_t> row_starts;   ///< Index of the first segment of each row.
+        uint32_t get_row_count() const { return row_starts.size(); }
+    };
+
+    // soft wrapping (see set_wrap()): just the lines around the view are
+    // laid out in rows, the row counts of the others are estimated
+    bool m_wrap = false;
+    uint32_t m_wrap_width = 0u;         ///< Width the rows are for.
+    RowIndex m_rows;                    ///< Rows of every line (empty until needed).
+    std::unordered_map<uint32_t, WrapLayout> m_wrap_layouts;
+
+    // the search (if any), its matches are highlighted
+    std::unique_ptr<Search> m_search;
+    std::string m_search_query;
+    bool m_search_is_regex = false;
+    bool m_search_prompt_shown = false;
+    std::string m_search_error;
+    std::optional<SearchMatch> m_current_match;
+    std::optional<std::chrono::steady_clock::time_point> m_search_due;    ///< When an edited query is searched for.
+
+    /// How far the background work (loading, searching) has got, as far as it shows.
+    class Progress {
+    public:
+        size_t line_count = 0u;
+        int load_percent = 0;
+        size_t match_count = 0u;
+        bool is_running = false;
+        bool operator==(Progress const& other) const = default;
+    };
+    Progress m_shown_progress;      ///< As of the last frame.
+
+    // the lines ahead are rasterized in the background (see prefetch()),
+    // as far as the view is expected to scroll in the next few frames
+    bool m_prefetch_valid = false;      ///< False if the lines changed since the last prefetch.
+    uint32_t m_prefetch_top_line = 0u;  ///< Top line at the last prefetch.
+    int m_scroll_direction = 1;         ///< Of the last scroll: 1 down, -1 up.
+    float m_scroll_speed = 0.0f;        ///< Lines per frame, smoothed over frames.
+
+    Progress get_progress();
+    void update_document_size();
+    void update_frame(sdl::Renderer& renderer, Settings& settings);
+    void render_rows(sdl::Renderer& renderer, Settings& settings, uint32_t first, uint32_t last);
+    void render_lines(sdl::Renderer& renderer, Settings& settings, uint32_t first, uint32_t last);
+    void render_wrapped_rows(sdl::Renderer& renderer, Settings& settings, uint32_t first, uint32_t last);
+    void queue_loading_indicator(sdl::Renderer& renderer, Settings& settings);
+    std::vector<Segment> const& get_line_layout(uint32_t number, Line& line);
+    std::pair<size_t, size_t> find_visible_segments(std::vector<Segment> const& segments, int32_t line_x);
+    void queue_line_glyphs(sdl::Renderer& renderer, Settings& settings, uint32_t number, Line& line, sdl::Point2d topleft,
+        std::vector<HighlightRun> const* runs);
+    int32_t queue_styled_text(sdl::Renderer& renderer, Settings& settings, sdl::Point2d topleft, std::string_view text,
+        uint32_t offset, std::vector<HighlightRun> const* runs);
+    std::vector<HighlightRun> const* get_highlight_runs(Settings& settings, uint32_t number);
+    void draw_line_texture(sdl::Renderer& renderer, Settings& settings, uint32_t number, Line& line, sdl::Point2d topleft);
+    void sync_line_cache(Settings& settings);
+    bool uses_line_textures(Settings& settings, uint32_t number);
+    void prefetch(Settings& settings);
+    void add_prefetched_glyphs(sdl::Renderer& renderer);
+    void draw_match_highlights(sdl::Renderer& renderer, Settings& settings, uint32_t number, Line& line, sdl::Point2d topleft);
+    void draw_unit_highlights(sdl::Renderer& renderer, Settings& settings, std::vector<SearchMatch> const& matches,
+        uint64_t line_start, Line& line, std::vector<Segment> const& units, sdl::Point2d topleft);
+    void queue_search_prompt(sdl::Renderer& renderer, Settings& settings);
+    void scroll_to_match(SearchMatch const& match);
+    void take_document_change(Document::Change change, size_t last_line, bool pinned);
+
+    // with wrapping, the rows are counted over all lines; otherwise, a row is a line
+    uint64_t get_top_row();
+    uint64_t get_row_count();
+    void set_top_row(uint64_t row);
+    void update_rows();
+    void measure_rows();
+    uint32_t measure_line_rows(size_t number);
+    WrapLayout const& get_wrap_layout(uint32_t number, Line& line);
+    size_t fit_text(std::string_view text, int32_t available, int32_t& fitted_width);
+
+    /// The text takes the rect apart from the scrollbar.
+    void layout() override;
+
+    /// A view of the same document in the same place, see split().
+    View(View& other);
 public:
     const uint32_t HORIZONTAL_SCROLL_AMOUNT = 128;
     const uint32_t SCROLLBAR_WIDTH = 32;
     const uint32_t MIN_INDICATOR_SIZE = 8;
     const uint32_t PADDING_TOP = 4;
+    const uint32_t LOADING_BAR_HEIGHT = 4;
+    const size_t MAX_CACHED_LINE_LENGTH = 1024;     ///< Longer lines always go through the glyph atlas.
+    const uint32_t FRAME_FORMAT = SDL_PIXELFORMAT_RGB888;
+    const size_t LAYOUT_SEGMENT_SIZE = 256;         ///< Bytes per segment of a long line layout.
+    const size_t MAX_LINE_LAYOUTS = 1024;
+    const int SEARCH_DELAY_MS = 150;
+    static constexpr int HIGHLIGHT_FILL_MS = 4;     ///< Of highlighting work per idle check.
+    const uint32_t PREFETCH_FRAMES = 8;             ///< Frames of scrolling at the current speed prefetched.
+    const uint32_t MAX_PREFETCH_PAGES = 4;
+    const size_t PREFETCH_SCAN_LENGTH = 4096;       ///< Bytes of a line looked through for glyphs to prefetch.
 
     uint32_t top_line_shown = 0u;       ///< Top line shown in the view.
+    uint32_t top_line_row = 0u;         ///< With wrapping, the row of the top line at the top of the view.
     uint32_t max_lines_shown = 0u;      ///< Max number of lines visible at once in the view.
     uint32_t scroll_x = 0u;             ///< Current amount of scroll to the right (in pixels).
     sdl::Size2d viewport_size;          ///< Size of the area used for view, in pixels.
     sdl::Size2d document_size;          ///< Document size in pixels.
 
-    View(std::shared_ptr<Document> document, std::shared_ptr<sdl::Font> font, sdl::Size2d viewport_size_);
+    /// Creates a view of the given size (placed at the origin until
+    /// set_rect()); the glyph atlas and the rasterizer may be shared with other views.
+    View(std::shared_ptr<Document> document, std::shared_ptr<sdl::Font> font, sdl::Size2d size,
+        std::shared_ptr<sdl::GlyphAtlas> glyph_atlas = nullptr, std::shared_ptr<Rasterizer> rasterizer = nullptr);
+
+    /// Returns a new view of the same document in the same place, sharing
+    /// everything that does not depend on the place (to be used as another pane).
+    std::shared_ptr<View> split();
+
+    /// Changes the font; the view no longer shares the bounds, the glyph atlas and the rasterizer.
+    void set_font(std::shared_ptr<sdl::Font> font);
+
+    std::shared_ptr<Document> const& get_document() const { return m_document; }
+
+    /**
+     * Turns soft wrapping on or off. With wrapping, the lines are broken
+     * into rows of the view width (at spaces, or anywhere in a word wider
+     * than the view), and the view scrolls by rows; there is no horizontal
+     * scrolling. Only the lines around the view are broken, the rows of
+     * the others are estimated from their length, so that turning it on
+     * takes one pass over the line lengths. Wrapped lines are always
+     * drawn through the glyph atlas (as are highlighted lines).
+     */
+    void set_wrap(bool wrap);
+    bool is_wrapped() const { return m_wrap; }
+
+    /// Like invalidate(), but the content changed, so no part of the
+    /// last frame can be reused.
+    void invalidate_frame();
     void scroll_line_up();
     void scroll_line_down();
     void scroll_block_left();
     void scroll_block_right();
+
+    /// Scrolls by a number of lines down (negative: up), within the document.
+    void scroll_lines(int delta);
+
+    /// Scrolls by a number of blocks right (negative: left), within the document.
+    void scroll_blocks(int delta);
+
+    /// Makes the view fill the output (a no-op unless its size changed).
     void update_viewport_size(sdl::Renderer& renderer);
     void scroll_to_indicator(uint32_t new_indicator_position);
+    void scroll_to_end();
+    bool is_scrolled_to_end();
+
+    /// Invalidates the view if the background work has progressed since
+    /// the last frame. Returns true while any of it is still running
+    /// (including the highlighting work left for fill_highlights()).
+    bool check_background_work();
+
+    /// Does the highlighting work left for idle time, for up to
+    /// HIGHLIGHT_FILL_MS per document (shared by the views of it).
+    static void fill_highlights(std::vector<std::shared_ptr<View>> const& views);
+
+    /// Takes in the changes of a followed file, keeping the view
+    /// pinned to the end if it was there. Returns true if anything changed.
+    bool refresh_document() { return refresh_document({ this }); }
+
+    /// Like refresh_document(), for all the views of one document at once
+    /// (they must share the bounds, i.e. come from split()).
+    static bool refresh_document(std::vector<View*> const& views);
+
+    /// Starts searching for the text (or a regular expression), cancelling
+    /// any previous search. The search prompt is shown until clear_search().
+    void start_search(std::string query, bool is_regex);
+
+    /// Like start_search(), for a query being typed: the previous search is
+    /// cancelled right away, but the new one starts only once the query has
+    /// not changed for SEARCH_DELAY_MS (see check_background_work()).
+    void edit_search(std::string query, bool is_regex);
+    void clear_search();
+    bool has_search() const { return m_search_prompt_shown; }
+    std::string const& get_search_query() const { return m_search_query; }
+    bool is_search_regex() const { return m_search_is_regex; }
+
+    /// Moves to the next (previous) match found so far. Returns false if there is none.
+    bool find_next_match();
+    bool find_previous_match();
+
     VScrollbar& get_scrollbar() { return m_scrollbar; }
+    LineTextureCache& get_line_cache() { return m_line_cache; }
 
     void render(sdl::Renderer& renderer, Settings& settings) override;
-    WidgetSizingInfo get_sizing_info() override {
+    WidgetSizingInfo calc_sizing_info() override {
         return WidgetSizingInfo {
             .min_width = 128u,
             .min_height = 128u,
@@ -42,5 +268,3 @@ public:
         };
     }
 };
-
-sdl::Size2d calc_document_bounds(Document& document, sdl::Font& font);
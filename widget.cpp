@@ -1,16 +1,48 @@
 #include "widget.hpp"
 #include "settings.hpp"
+#include "trace.hpp"
+#include <cstring>
+
+void Widget::set_rect(sdl::Rect rect)
+{
+    if (rect == m_rect && !m_layout_dirty) {
+        return;
+    }
+    m_rect = rect;
+    m_layout_dirty = false;
+    layout();
+    invalidate();
+}
+
+void Widget::invalidate_layout()
+{
+    for (auto widget = this; widget; widget = widget->m_parent) {
+        widget->m_layout_dirty = true;
+        widget->m_sizing_info.reset();
+    }
+}
+
+WidgetSizingInfo const& Widget::get_sizing_info()
+{
+    if (!m_sizing_info) {
+        m_sizing_info = calc_sizing_info();
+    }
+    return *m_sizing_info;
+}
 
 void VScrollbar::render(sdl::Renderer& renderer, Settings& settings)
 {
     // draw the bar
     renderer.fill_rect(m_rect, settings.widget_background_color);
-    uint32_t indicator_size = std::max(MIN_INDICATOR_HEIGHT, m_rect.h * marked_range_length / full_range);
+    if (full_range == 0) {
+        return;
+    }
+    uint32_t indicator_size = std::max<uint64_t>(MIN_INDICATOR_HEIGHT, m_rect.h * marked_range_length / full_range);
     uint32_t indicator_position = m_rect.h * marked_range_start / full_range;
 
     // draw the indicator
     renderer.fill_rect(
-        sdl::Rect(m_rect.x, indicator_position, m_rect.w, indicator_size),
+        sdl::Rect(m_rect.x, m_rect.y + indicator_position, m_rect.w, indicator_size),
         settings.widget_indicator_color);
 }
 
@@ -36,3 +68,51 @@ void Label::render(sdl::Renderer& renderer, Settings& settings)
     );
     renderer.put_texture(texture, topleft);
 }
+
+// ---- FrameGraph -----------------------------------------------------------
+
+// the phases stacked in the bars; they do not nest in one another
+static const std::pair<char const*, sdl::Color> GRAPHED_PHASES[] = {
+    { "TTF_RenderGlyph32_Blended", sdl::Color(224, 64, 64) },
+    { "TTF_RenderUTF8_Blended", sdl::Color(224, 128, 64) },
+    { "SDL_CreateTextureFromSurface", sdl::Color(224, 192, 64) },
+    { "SDL_RenderCopy", sdl::Color(64, 160, 64) },
+    { "SDL_RenderGeometry", sdl::Color(64, 160, 224) },
+    { "present", sdl::Color(160, 96, 224) },
+};
+
+void FrameGraph::render(sdl::Renderer& renderer, Settings& settings)
+{
+    if (!trace::is_enabled()) {
+        return;
+    }
+    renderer.fill_rect(m_rect, settings.widget_background_color);
+    auto bar_height = [&](uint64_t duration_us) {
+        return int(std::min<uint64_t>(m_rect.h, duration_us * PIXELS_PER_MS / 1000u));
+    };
+
+    // newest frame on the right
+    auto frames = trace::get_frames();
+    auto bottom = m_rect.y + m_rect.h;
+    auto x = m_rect.x + m_rect.w - int(frames.size() * BAR_WIDTH);
+    for (auto& frame : frames) {
+        auto height = bar_height(frame.duration_us);
+        renderer.fill_rect(sdl::Rect(x, bottom - height, BAR_WIDTH, height), settings.widget_indicator_color);
+
+        // the phases, stacked from the bottom
+        uint64_t stacked_us = 0u;
+        for (auto& [name, color] : GRAPHED_PHASES) {
+            for (auto& [phase_name, duration_us] : frame.phases) {
+                if (0 == strcmp(phase_name, name)) {
+                    auto y = bottom - bar_height(stacked_us + duration_us);
+                    renderer.fill_rect(sdl::Rect(x, y, BAR_WIDTH, bottom - bar_height(stacked_us) - y), color);
+                    stacked_us += duration_us;
+                }
+            }
+        }
+        x += BAR_WIDTH;
+    }
+
+    auto budget_y = bottom - bar_height(FRAME_BUDGET_US);
+    renderer.fill_rect(sdl::Rect(m_rect.x, budget_y, m_rect.w, 1), settings.widget_text_color);
+}
@@ -3,6 +3,7 @@
 #include "settings.hpp"
 #include <functional>
 #include <memory>
+#include <optional>
 
 /// Describes how a widget should be (re)sized.
 class WidgetSizingInfo {
@@ -13,22 +14,53 @@ public:
     bool grow_y;        ///< Is it useful to grow this widget in the Y direction?
 };
 
+/**
+ * The layout is cached: a widget is laid out again only when its rect
+ * changes or when invalidate_layout() was called (the content changed
+ * so that the sizing info may differ). invalidate_layout() goes up
+ * the tree of containers, so that a change deep down is laid out again
+ * on the next set_rect() of the root, and nothing else is.
+ */
 class Widget {
 protected:
     sdl::Rect m_rect;
+    bool m_dirty = true;            ///< Set when the widget needs to be drawn again.
+    bool m_layout_dirty = true;     ///< Set when the widget needs to be laid out again.
+    std::optional<WidgetSizingInfo> m_sizing_info;     ///< Cached calc_sizing_info().
+    Widget* m_parent = nullptr;     ///< The container, if any.
+
+    virtual WidgetSizingInfo calc_sizing_info() = 0;
+
+    /// Arranges the content within m_rect (called by set_rect() when needed).
+    virtual void layout() {}
 public:
-    void set_rect(sdl::Rect rect) { m_rect = rect; }
+    virtual ~Widget() {}
+
+    /// Places the widget, laying it out again if the rect changed or
+    /// the layout was invalidated; otherwise does nothing.
+    void set_rect(sdl::Rect rect);
+    void set_parent(Widget* parent) { m_parent = parent; }
+
+    /// Requests the widget to be laid out again, along with its containers.
+    void invalidate_layout();
+    bool is_layout_dirty() const { return m_layout_dirty; }
+
+    /// Requests the widget to be drawn again (frames are drawn only then).
+    void invalidate() { m_dirty = true; }
+    bool is_dirty() const { return m_dirty; }
+
     sdl::Rect get_rect() { return m_rect; }
     bool is_point_inside(sdl::Point2d point) { return m_rect.is_point_inside(point); }
     virtual void render(sdl::Renderer& renderer, Settings& settings) = 0;
-    virtual WidgetSizingInfo get_sizing_info() = 0;
+
+    WidgetSizingInfo const& get_sizing_info();
 };
 
 class VScrollbar : public Widget {
 protected:
-    uint32_t full_range = 0u;
-    uint32_t marked_range_length = 0u;
-    uint32_t marked_range_start = 0u;
+    uint64_t full_range = 0u;
+    uint64_t marked_range_length = 0u;
+    uint64_t marked_range_start = 0u;
     std::function<void(uint32_t)> value_callback;
 public:
     const uint32_t MIN_INDICATOR_HEIGHT = 8u;
@@ -36,7 +68,7 @@ public:
     VScrollbar() {}
     void render(sdl::Renderer& renderer, Settings& settings) override;
 
-    WidgetSizingInfo get_sizing_info() override {
+    WidgetSizingInfo calc_sizing_info() override {
         return WidgetSizingInfo {
             .min_width = 32u,
             .min_height = 128u,
@@ -45,8 +77,8 @@ public:
         };
     }
 
-    void set_full_range(uint32_t l) { full_range = l; }
-    void set_marked_range(uint32_t start, uint32_t length) {
+    void set_full_range(uint64_t l) { full_range = l; }
+    void set_marked_range(uint64_t start, uint64_t length) {
         marked_range_start = start;
         marked_range_length = length;
     }
@@ -63,7 +95,7 @@ public:
     void render(sdl::Renderer& renderer, Settings& settings) override;
     void set_text(std::string text) { m_text = text; }
 
-    WidgetSizingInfo get_sizing_info() override {
+    WidgetSizingInfo calc_sizing_info() override {
         return WidgetSizingInfo {
             .min_width = 128u,
             .min_height = 32u,
@@ -72,3 +104,24 @@ public:
         };
     }
 };
+
+/// Overlay graph of the last frame times (see trace::get_frames()), one
+/// bar per frame, with the time spent in the SDL and TTF calls stacked
+/// at its bottom. Shows nothing unless tracing is enabled.
+class FrameGraph : public Widget {
+public:
+    static const uint32_t BAR_WIDTH = 2u;
+    static const uint32_t PIXELS_PER_MS = 4u;
+    static const uint32_t FRAME_BUDGET_US = 16667u;     ///< One frame at 60 Hz, marked by a line.
+
+    void render(sdl::Renderer& renderer, Settings& settings) override;
+
+    WidgetSizingInfo calc_sizing_info() override {
+        return WidgetSizingInfo {
+            .min_width = 512u,
+            .min_height = 128u,
+            .grow_x = false,
+            .grow_y = false
+        };
+    }
+};